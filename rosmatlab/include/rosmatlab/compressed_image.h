@@ -0,0 +1,45 @@
+//=================================================================================================
+// Copyright (c) 2013, Johannes Meyer, TU Darmstadt
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of the Flight Systems and Automatic Control group,
+//       TU Darmstadt, nor the names of its contributors may be used to
+//       endorse or promote products derived from this software without
+//       specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//=================================================================================================
+
+#ifndef ROSMATLAB_COMPRESSED_IMAGE_H
+#define ROSMATLAB_COMPRESSED_IMAGE_H
+
+#include <cstddef>
+#include <stdint.h>
+
+namespace rosmatlab {
+
+// Decoding of the JPEG and PNG data of sensor_msgs/CompressedImage messages into column-major HxWxC
+// uint8 arrays (gray, RGB or RGBA). readImageHeader() only parses the header to allocate the array,
+// decompressImage() does not call into the mx API and can run in worker threads.
+bool readImageHeader(const uint8_t *data, std::size_t length, std::size_t& height, std::size_t& width, std::size_t& channels);
+bool decompressImage(const uint8_t *data, std::size_t length, uint8_t *target, std::size_t height, std::size_t width, std::size_t channels);
+
+} // namespace rosmatlab
+
+#endif // ROSMATLAB_COMPRESSED_IMAGE_H
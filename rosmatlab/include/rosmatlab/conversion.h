@@ -33,8 +33,12 @@
 #include <matrix.h>
 
 #include <rosmatlab/options.h>
+#include <rosmatlab/conversion_options.h>
+#include <rosmatlab/decoder.h>
+#include <rosmatlab/serialized_buffers.h>
 
 #include <ros/time.h>
+#include <ros/serialized_message.h>
 
 namespace rosmatlab {
 
@@ -42,31 +46,11 @@ using namespace cpp_introspection;
 
 class Conversion;
 typedef boost::shared_ptr<Conversion> ConversionPtr;
+class StaticConverter;
 
 typedef mxArray *Array;
 typedef mxArray const *ConstArray;
 
-class ConversionOptions : public Options {
-public:
-  ConversionOptions();
-  ConversionOptions(int nrhs, const mxArray *prhs[]);
-  virtual ~ConversionOptions();
-
-  virtual void init(int nrhs, const mxArray *prhs[]);
-  virtual mxArray *toMatlab() const;
-
-  typedef enum { MATLAB_STRUCT, MATLAB_MATRIX, MATLAB_EXTENDED_STRUCT, MATLAB_TYPE_MAX } MatlabType;
-  MatlabType conversionType() const;
-  std::string conversionTypeString() const;
-  ConversionOptions &setConversionType(MatlabType type);
-
-  bool addMetaData() const;
-  ConversionOptions &setAddMetaData(bool value);
-
-  bool addConnectionHeader() const;
-  ConversionOptions &setAddConnectionHeader(bool value);
-};
-
 class Conversion {
 public:
   Conversion(const MessagePtr &message);
@@ -75,9 +59,16 @@ public:
   virtual ~Conversion();
 
   operator void *() const { return reinterpret_cast<void *>(static_cast<bool>(message_)); }
+  const MessagePtr& getMessage() const { return message_; }
 
   virtual Array toMatlab();
   virtual Array toMatlab(Array target, std::size_t index = 0, std::size_t size = 0);
+  virtual Array toMatlab(ros::serialization::IStream& stream, Array target = 0, std::size_t index = 0, std::size_t size = 0);
+  bool canDecode();
+
+  // defer filling large numeric payloads to jobs (see Decoder::Jobs)
+  // Required for batches with dictionary-encoded strings, which share the dictionary of the jobs.
+  Conversion &setJobs(Decoder::Jobs *jobs);
 
   virtual Array toDoubleMatrix();
   virtual Array toDoubleMatrix(Array target, std::size_t index = 0, std::size_t size = 0);
@@ -91,12 +82,16 @@ public:
   virtual std::size_t numberOfInstances(ConstArray source);
   virtual MessagePtr fromMatlab(ConstArray source, std::size_t index = 0);
   virtual void fromMatlab(const MessagePtr &message, ConstArray source, std::size_t index = 0);
+  bool serialize(ConstArray source, std::size_t index, ros::SerializedMessage& m);
+  bool serializeColumns(ConstArray source, std::vector<ros::SerializedMessage>& messages);
+  const DecoderConstPtr& encoder();
 
   virtual Array convertToMatlab(const FieldPtr& field);
   virtual void convertFromMatlab(const FieldPtr& field, ConstArray source);
   virtual const double *convertFromDouble(const FieldPtr& field, const double *begin, const double *end);
 
   const MessagePtr& expanded();
+  Conversion &setMessage(const MessagePtr &message);
 
   Options &options() { return options_; }
   const Options &options() const { return options_; }
@@ -109,11 +104,39 @@ protected:
   virtual void fromDoubleMatrix(const MessagePtr &target, ConstArray source, std::size_t n = 0);
   virtual void fromDoubleMatrix(const MessagePtr &target, const double *begin, const double *end);
   virtual void fromStruct(const MessagePtr &target, ConstArray source, std::size_t index = 0);
+  Array decode(Array target, std::size_t index, std::size_t size);
+  bool needsLocalJobs(std::size_t size) const;
+  Conversion& getChild(std::size_t position, const MessagePtr& message);
+  void serialize(std::vector<uint8_t>& buffer);
+
+  Array toDoubleMatrix(Array target, std::size_t index, std::size_t size, std::vector<std::string> *strings);
+  void resizeDoubleMatrix(Array target, std::size_t rows, std::size_t columns);
+  bool canFlatten();
 
   MessagePtr message_;
   MessagePtr expanded_;
+  DecoderConstPtr decoder_;
+  Decoder::PlanConstPtr plan_;
+  bool decoder_checked_;
+  const StaticConverter *converter_;
+  std::vector<uint8_t> buffer_;
+  DecoderConstPtr encoder_;
+  bool encoder_checked_;
+  Decoder::Jobs *jobs_;
+  DecoderConstPtr flattener_;
+  bool flattener_checked_;
+  Array matrix_;
+  void *matrix_data_;
+  std::size_t matrix_capacity_;
+
+  // conversions of nested message fields in toStruct(), by field position
+  std::vector<ConversionPtr> children_;
+
+  // buffers of serialized messages, reused as soon as roscpp has released them
+  SerializedBuffers serialized_;
 
   ConversionOptions options_;
+  ConversionOptions::Snapshot settings_;
   static std::map<const char *,ConversionOptions> per_message_options_;
 };
 
@@ -0,0 +1,102 @@
+//=================================================================================================
+// Copyright (c) 2012, Johannes Meyer, TU Darmstadt
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of the Flight Systems and Automatic Control group,
+//       TU Darmstadt, nor the names of its contributors may be used to
+//       endorse or promote products derived from this software without
+//       specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//=================================================================================================
+
+#ifndef ROSMATLAB_CONVERSION_OPTIONS_H
+#define ROSMATLAB_CONVERSION_OPTIONS_H
+
+#include <rosmatlab/options.h>
+
+namespace rosmatlab {
+
+class ConversionOptions : public Options {
+public:
+  ConversionOptions();
+  ConversionOptions(int nrhs, const mxArray *prhs[]);
+  virtual ~ConversionOptions();
+
+  virtual void init(int nrhs, const mxArray *prhs[]);
+  virtual mxArray *toMatlab() const;
+
+  typedef enum { MATLAB_STRUCT, MATLAB_MATRIX, MATLAB_EXTENDED_STRUCT, MATLAB_COLUMNAR, MATLAB_TYPE_MAX } MatlabType;
+  MatlabType conversionType() const;
+  std::string conversionTypeString() const;
+  ConversionOptions &setConversionType(MatlabType type);
+
+  typedef enum { NUMERIC_DOUBLE, NUMERIC_NATIVE, NUMERIC_TYPE_MAX } NumericType;
+  NumericType numericType() const;
+  std::string numericTypeString() const;
+  ConversionOptions &setNumericType(NumericType type);
+
+  // strings of columnar and extended conversions can be encoded as indices into a dictionary per batch
+  typedef enum { STRINGS_CHAR, STRINGS_DICTIONARY, STRINGS_CATEGORICAL, STRING_TYPE_MAX } StringType;
+  StringType stringType() const;
+  std::string stringTypeString() const;
+  ConversionOptions &setStringType(StringType type);
+
+  bool addMetaData() const;
+  ConversionOptions &setAddMetaData(bool value);
+
+  bool addConnectionHeader() const;
+  ConversionOptions &setAddConnectionHeader(bool value);
+
+  // images and MultiArrays are converted to HxWxC and N-D arrays instead of flat data vectors
+  bool reshapeArrays() const;
+  ConversionOptions &setReshapeArrays(bool value);
+
+  // the data of PointCloud2 messages as raw bytes, as NxK matrix of all fields or as struct with one column per field
+  typedef enum { POINTCLOUD_RAW, POINTCLOUD_MATRIX, POINTCLOUD_FIELDS, POINTCLOUD_TYPE_MAX } PointCloudType;
+  PointCloudType pointCloudType() const;
+  std::string pointCloudTypeString() const;
+  ConversionOptions &setPointCloudType(PointCloudType type);
+
+  // drop points with NaN coordinates from converted point clouds
+  bool removeNaN() const;
+  ConversionOptions &setRemoveNaN(bool value);
+
+  // JPEG and PNG data of CompressedImage messages is decoded into HxWxC uint8 arrays
+  bool decompressImages() const;
+  ConversionOptions &setDecompressImages(bool value);
+
+  // immutable copy of the values used while converting messages, so that the hot path does not look them up by name
+  struct Snapshot {
+    MatlabType type;
+    NumericType numeric;
+    StringType strings;
+    bool add_meta_data;
+    bool add_connection_header;
+    bool reshape;
+    PointCloudType pointcloud;
+    bool remove_nan;
+    bool decompress;
+  };
+  Snapshot snapshot() const;
+};
+
+} // namespace rosmatlab
+
+#endif // ROSMATLAB_CONVERSION_OPTIONS_H
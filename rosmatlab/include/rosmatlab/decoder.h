@@ -0,0 +1,259 @@
+//=================================================================================================
+// Copyright (c) 2013, Johannes Meyer, TU Darmstadt
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of the Flight Systems and Automatic Control group,
+//       TU Darmstadt, nor the names of its contributors may be used to
+//       endorse or promote products derived from this software without
+//       specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//=================================================================================================
+
+#ifndef ROSMATLAB_DECODER_H
+#define ROSMATLAB_DECODER_H
+
+#include <introspection/forwards.h>
+#include <matrix.h>
+
+#include <rosmatlab/conversion_options.h>
+
+#include <ros/serialization.h>
+#include <boost/shared_ptr.hpp>
+#include <boost/shared_array.hpp>
+#include <boost/atomic.hpp>
+
+#include <string>
+#include <vector>
+#include <list>
+#include <map>
+
+namespace rosmatlab {
+
+class Decoder;
+typedef boost::shared_ptr<Decoder> DecoderPtr;
+typedef boost::shared_ptr<Decoder const> DecoderConstPtr;
+
+/*
+  A Decoder converts serialized messages directly to Matlab arrays and Matlab structs back to
+  serialized messages. The layout is parsed from the full message definition, so no intermediate
+  message instance has to be (de)serialized field by field.
+*/
+class Decoder {
+public:
+  typedef enum { BOOL, INT8, UINT8, INT16, UINT16, INT32, UINT32, INT64, UINT64, FLOAT32, FLOAT64, STRING, TIME, DURATION, MESSAGE } FieldType;
+
+  struct Field {
+    std::string name;
+    FieldType type;
+    bool is_array;
+    std::size_t array_length; // 0 for variable-length arrays
+    DecoderConstPtr message;
+  };
+  typedef std::vector<Field> Fields;
+
+  // A Plan holds everything that depends on the conversion options. It is compiled once per
+  // datatype and set of options and reused for all following messages.
+  struct Plan;
+  typedef boost::shared_ptr<Plan const> PlanConstPtr;
+
+  // Jobs fill the numeric payloads of arrays that have already been allocated on the Matlab thread.
+  class Jobs;
+
+  static DecoderConstPtr forMessage(const cpp_introspection::MessagePtr& message);
+  // without introspection, e.g. for the full definition of a connection header (throws if it cannot be parsed)
+  static DecoderConstPtr forDefinition(const std::string& datatype, const std::string& definition);
+  static bool getFieldType(const std::string& type, FieldType& result);
+  static mxClassID getClassID(FieldType type, bool native = true);
+  static std::size_t getSize(FieldType type);
+  static void invalidatePlans();
+  virtual ~Decoder();
+
+  const std::string& getDataType() const { return datatype_; }
+  const cpp_introspection::MessagePtr& getIntrospection() const { return introspection_; }
+  const Fields& getFields() const { return fields_; }
+  const std::vector<const char *>& getFieldNames() const { return field_names_; }
+
+  PlanConstPtr compile(const ConversionOptions::Snapshot& options) const;
+  bool supports(const ConversionOptions& options) const;
+  mxArray *decode(ros::serialization::IStream& stream, const ConversionOptions& options, mxArray *target = 0, std::size_t index = 0, std::size_t size = 0) const;
+  mxArray *decode(ros::serialization::IStream& stream, const Plan& plan, mxArray *target = 0, std::size_t index = 0, std::size_t size = 0, Jobs *jobs = 0) const;
+
+  // flattened layout of the 'matrix' and 'extended' conversions, one double per element (NaN for strings)
+  // It is only used for messages without variable-length arrays after it has been verified against expand().
+  bool isFlat() const;
+  bool needsFlatVerification() const;
+  void verifyFlatLayout(std::size_t expanded_size) const;
+  std::size_t getFlatSize() const { return flat_size_; }
+  double *flatten(ros::serialization::IStream& stream, double *x, std::vector<std::string> *strings = 0) const;
+
+  // inverse of flatten(): serializes one column into data and advances it, strings are written empty
+  const double *unflatten(const double *x, uint8_t *&data) const;
+  // number of messages in a double matrix with one flattened message per column, or 0 if it does not have that layout
+  // A row vector of the flat size is a single message, like in Conversion::fromDoubleMatrix().
+  std::size_t getFlatColumns(const mxArray *source) const;
+  // serializes the columns of a flat matrix to data + j * stride, in parallel for large batches
+  void unflatten(const double *x, std::size_t columns, uint8_t *data, std::size_t stride) const;
+
+  // true if the message has variable-length numeric arrays (images, point clouds, ...)
+  bool hasPayload() const { return payload_; }
+
+  // Converts numeric field i of a typed message instance (see StaticConverter) from count elements at data, which have
+  // the same layout as in the serialized message. The data field of images, MultiArrays and point clouds is reshaped
+  // as in decode() if the other fields have already been set in target(index). Large payloads are left to the jobs,
+  // so the instance must stay valid until they have run.
+  mxArray *decodeArray(const Plan& plan, std::size_t i, const mxArray *target, std::size_t index, const uint8_t *data, std::size_t count, Jobs *jobs = 0) const;
+
+  // true if value is an N-D array given for the data field i of an image or MultiArray
+  bool isShapedField(std::size_t i, const mxArray *value) const;
+
+  // serialize element index of a Matlab struct array into buffer, false if the layout of source is not supported
+  bool encode(const mxArray *source, std::size_t index, std::vector<uint8_t>& buffer) const;
+
+  // number of bytes written by encode() to allocate the buffer at once (cached for messages of fixed size),
+  // N-D image data of class double is estimated by its number of elements
+  std::size_t getEncodedLength(const mxArray *source, std::size_t index) const;
+
+protected:
+  Decoder(const std::string& datatype);
+
+  typedef std::map<std::string, std::string> Definitions;
+  typedef std::map<std::string, DecoderPtr> Decoders;
+  static DecoderPtr parse(const std::string& datatype, const std::string& definition);
+  static DecoderPtr parse(const std::string& datatype, const Definitions& definitions, Decoders& decoders);
+
+  mxArray *decodeField(ros::serialization::IStream& stream, const Plan& plan, std::size_t i, Jobs *jobs) const;
+  mxArray *decodeColumnar(ros::serialization::IStream& stream, const Plan& plan, mxArray *target, std::size_t index, std::size_t size, Jobs *jobs) const;
+  mxArray *decodeNumeric(const Plan& plan, std::size_t i, const uint8_t *data, std::size_t count, Jobs *jobs) const;
+  mxArray *decodeShaped(ros::serialization::IStream& stream, const Plan& plan, const mxArray *target, std::size_t index, Jobs *jobs) const;
+  mxArray *decodeShaped(const Plan& plan, const mxArray *target, std::size_t index, const uint8_t *data, std::size_t count, Jobs *jobs) const;
+  mxArray *decodePointCloud(const Plan& plan, const mxArray *target, std::size_t index, const uint8_t *data, std::size_t length) const;
+  mxArray *decodeCompressedImage(const uint8_t *data, std::size_t length, Jobs *jobs) const;
+  bool encodeShaped(const mxArray *source, std::size_t index, const mxArray *data, const std::size_t *offsets, std::vector<uint8_t>& buffer) const;
+  mxArray *createColumn(const Plan& plan, std::size_t i, std::size_t rows) const;
+  void decodeColumn(ros::serialization::IStream& stream, const Plan& plan, std::size_t i, mxArray *column, std::size_t row, Jobs *jobs) const;
+  bool encodeField(const mxArray *source, const Field& field, std::vector<uint8_t>& buffer) const;
+  std::size_t getEncodedFieldLength(const mxArray *source, const Field& field) const;
+  const mxArray *getFieldSource(const mxArray *source, std::size_t index, std::size_t i, int number_of_fields) const;
+
+private:
+  std::string datatype_;
+  cpp_introspection::MessagePtr introspection_;
+  Fields fields_;
+  std::vector<const char *> field_names_;
+
+  bool flat_;
+  std::size_t flat_size_;
+  mutable int flat_verified_;
+  bool payload_;
+  bool fixed_length_;
+  std::size_t encoded_length_;
+
+  // row-major data arrays that are reshaped into column-major Matlab arrays, split into point cloud fields
+  // or decompressed
+  typedef enum { SHAPE_NONE, SHAPE_IMAGE, SHAPE_MULTIARRAY, SHAPE_POINTCLOUD, SHAPE_COMPRESSED } Shape;
+  Shape shape_;
+  std::size_t shape_field_;
+  std::size_t getFieldIndex(const std::string& name) const;
+
+  mutable std::map<int, PlanConstPtr> plans_;
+  mutable unsigned int plans_generation_;
+  static unsigned int generation_;
+};
+
+struct Decoder::Plan {
+  bool supported;                         // all nested messages are converted to structs or columns
+  bool columnar;                          // one struct of Nx1 (or NxK) columns for N messages
+  ConversionOptions::StringType strings;  // encoding of string columns
+  bool reshape;                           // data of images and MultiArrays as HxWxC and N-D arrays, of point clouds as below
+  ConversionOptions::PointCloudType pointcloud;  // data of point clouds as NxK matrix or struct of fields
+  bool remove_nan;                        // drop points with NaN coordinates
+  bool decompress;                        // decode the data of compressed images
+  bool transforms;                        // this plan or any of its children reshapes its data
+  bool add_meta_data;
+  std::vector<mxClassID> class_ids;       // Matlab class of each field
+  std::vector<PlanConstPtr> children;     // plans of nested message fields, null for primitives
+};
+
+/*
+  Two-phase conversion: while decoding a batch on the Matlab thread, all arrays are allocated but
+  large numeric payloads are only recorded. run() copies them afterwards on a pool of worker
+  threads, which does not call into the mx API. The serialized data must stay valid until then,
+  e.g. in a buffer returned by hold(). Compressed images are decoded by the same workers, one
+  job per image.
+
+  Jobs also intern the dictionary-encoded strings of a batch. finish() runs the remaining jobs and
+  replaces the index arrays by their final representation, so it must be called at the end of a batch.
+*/
+class Decoder::Jobs {
+public:
+  static const std::size_t MIN_LENGTH = 4096;             // smaller payloads are copied immediately
+  static const std::size_t CHUNK_LENGTH = 1 << 20;        // maximum number of source bytes per job
+  static const std::size_t PARALLEL_LENGTH = 1 << 22;     // run in the calling thread below
+
+  Jobs();
+  ~Jobs();
+
+  void copy(void *target, const uint8_t *source, std::size_t length);
+  void toLogical(mxLogical *target, const uint8_t *source, std::size_t count);
+  void toDouble(double *target, const uint8_t *source, FieldType type, std::size_t count);
+  void decompress(uint8_t *target, const uint8_t *source, std::size_t length, std::size_t height, std::size_t width, std::size_t channels);
+  std::vector<uint8_t>& hold(std::size_t size);
+  uint8_t *allocate(std::size_t size);  // like hold(), but not initialized
+
+  uint32_t intern(mxArray *parent, const char *field, mxArray *index, const std::string& value, bool categorical);
+
+  std::size_t length() const { return length_; }
+  void run();
+  void finish();
+
+private:
+  typedef enum { COPY, LOGICAL, DOUBLE, DECOMPRESS } Kind;
+  struct Job {
+    Kind kind;
+    FieldType type;
+    void *target;
+    const uint8_t *source;
+    std::size_t count;
+    std::size_t height, width, channels;  // of decompressed images
+  };
+
+  void add(Kind kind, FieldType type, void *target, const uint8_t *source, std::size_t count);
+  void work(boost::atomic<std::size_t>& next) const;
+
+  std::vector<Job> jobs_;
+  std::list<std::vector<uint8_t> > buffers_;
+  std::vector<boost::shared_array<uint8_t> > blocks_;
+  std::size_t length_;
+  std::size_t images_;
+
+  struct Dictionary {
+    Dictionary() : parent(0), categorical(false) {}
+    mxArray *parent;
+    std::string field;
+    bool categorical;
+    std::map<std::string, uint32_t> ids;
+    std::vector<std::string> values;
+  };
+  std::map<mxArray *, Dictionary> dictionaries_;
+};
+
+} // namespace rosmatlab
+
+#endif // ROSMATLAB_DECODER_H
@@ -0,0 +1,125 @@
+//=================================================================================================
+// Copyright (c) 2013, Johannes Meyer, TU Darmstadt
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of the Flight Systems and Automatic Control group,
+//       TU Darmstadt, nor the names of its contributors may be used to
+//       endorse or promote products derived from this software without
+//       specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//=================================================================================================
+
+#ifndef ROSMATLAB_HANDOFF_H
+#define ROSMATLAB_HANDOFF_H
+
+#include <boost/lockfree/spsc_queue.hpp>
+#include <boost/atomic.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/thread_time.hpp>
+
+namespace rosmatlab {
+
+/*
+  Bounded queue between exactly one producer and one consumer thread. push() and pop() are lock-free,
+  the mutex is only taken to wake up the other thread if it waits in waitForData() or waitForSpace().
+
+  A waiting thread sets its flag and then checks the queue, the other thread changes the queue and
+  then checks the flag. Both sides are separated by a seq_cst fence, otherwise the store could be
+  reordered after the load and the wakeup would be lost.
+*/
+template <typename T>
+class Handoff {
+public:
+  explicit Handoff(std::size_t capacity)
+    : queue_(capacity), capacity_(capacity), closed_(false), consumer_waiting_(false), producer_waiting_(false) {}
+
+  std::size_t capacity() const { return capacity_; }
+  std::size_t size() const { return queue_.read_available(); }
+  bool empty() const { return size() == 0; }
+  bool full() const { return !hasSpace(); }   // producer side
+
+  // producer side, false if the queue is full
+  bool push(const T& value) {
+    if (!queue_.push(value)) return false;
+    wake(consumer_waiting_);
+    return true;
+  }
+
+  // consumer side, false if the queue is empty
+  bool pop(T& value) {
+    if (!queue_.pop(value)) return false;
+    wake(producer_waiting_);
+    return true;
+  }
+
+  // called by the consumer, false on timeout or if the queue has been closed and is empty
+  bool waitForData() { return wait(consumer_waiting_, &Handoff::hasData, 0); }
+  bool waitForData(const boost::system_time& deadline) { return wait(consumer_waiting_, &Handoff::hasData, &deadline); }
+
+  // called by the producer, false on timeout
+  bool waitForSpace() { return wait(producer_waiting_, &Handoff::hasSpace, 0); }
+  bool waitForSpace(const boost::system_time& deadline) { return wait(producer_waiting_, &Handoff::hasSpace, &deadline); }
+
+  // called by the producer after the last value, the consumer still receives the values in the queue
+  void close() {
+    boost::mutex::scoped_lock lock(mutex_);
+    closed_ = true;
+    condition_.notify_all();
+  }
+
+private:
+  bool hasData() const { return queue_.read_available() > 0; }
+  bool hasSpace() const { return queue_.write_available() > 0; }
+
+  bool wait(boost::atomic<bool>& waiting, bool (Handoff::*ready)() const, const boost::system_time *deadline) {
+    boost::mutex::scoped_lock lock(mutex_);
+    waiting.store(true, boost::memory_order_relaxed);
+    boost::atomic_thread_fence(boost::memory_order_seq_cst);
+    while(!(this->*ready)() && !closed_) {
+      if (!deadline) {
+        condition_.wait(lock);
+      } else if (!condition_.timed_wait(lock, *deadline)) {
+        break;
+      }
+    }
+    waiting.store(false, boost::memory_order_relaxed);
+    return (this->*ready)();
+  }
+
+  void wake(boost::atomic<bool>& waiting) {
+    boost::atomic_thread_fence(boost::memory_order_seq_cst);
+    if (!waiting.load(boost::memory_order_relaxed)) return;
+    boost::mutex::scoped_lock lock(mutex_);
+    condition_.notify_all();
+  }
+
+  boost::lockfree::spsc_queue<T> queue_;
+  std::size_t capacity_;
+  bool closed_;
+  boost::atomic<bool> consumer_waiting_;
+  boost::atomic<bool> producer_waiting_;
+  boost::mutex mutex_;
+  boost::condition_variable condition_;
+};
+
+} // namespace rosmatlab
+
+#endif // ROSMATLAB_HANDOFF_H
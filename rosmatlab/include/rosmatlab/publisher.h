@@ -30,11 +30,20 @@
 #define ROSMATLAB_PUBLISHER_H
 
 #include <rosmatlab/object.h>
+#include <rosmatlab/conversion.h>
+#include <rosmatlab/handoff.h>
 #include <ros/ros.h>
 #include <ros/callback_queue.h>
 
 #include <introspection/forwards.h>
 
+#include <boost/atomic.hpp>
+#include <boost/function.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+
 namespace rosmatlab {
 
 using cpp_introspection::VoidPtr;
@@ -52,6 +61,8 @@ public:
   mxArray *advertise(int nrhs, const mxArray *prhs[]);
 
   void publish(int nrhs, const mxArray *prhs[]);
+  void schedule(int nrhs, const mxArray *prhs[]);
+  void cancel();
 
   mxArray *getTopic() const;
   mxArray *getDataType() const;
@@ -59,12 +70,78 @@ public:
 
   mxArray *getNumSubscribers() const;
   mxArray *isLatched() const;
+  mxArray *getStatistics() const;
+
+private:
+  // a serialized message or, for sources that cannot be serialized directly, a message instance
+  // Outgoing messages are reused, so the serializer that roscpp calls for intraprocess subscribers is bound once.
+  struct Outgoing : private boost::noncopyable {
+    Outgoing();
+    void clear();
+    ros::SerializedMessage serialized;
+    MessagePtr message;
+    boost::function<ros::SerializedMessage()> serializer;
+  };
+  typedef boost::shared_ptr<Outgoing> OutgoingPtr;
+  typedef Handoff<OutgoingPtr> Queue;
+  void send(Outgoing& outgoing);
+  void dispatch(Outgoing& outgoing, const OutgoingPtr& queued);
+  OutgoingPtr acquire();
+  void enqueue(const OutgoingPtr& outgoing);
+  void run();
+  void stop();
+
+  // timed playback of a converted batch, messages are sent at their (scaled) time stamps by a separate thread
+  struct Playback {
+    std::vector<OutgoingPtr> messages;
+    std::vector<double> times;      // seconds relative to the start, or absolute if absolute is set
+    bool absolute;
+    bool ros_time;
+  };
+  typedef boost::shared_ptr<Playback> PlaybackPtr;
+  void play(PlaybackPtr playback);
 
 private:
   ros::NodeHandle node_handle_;
   ros::AdvertiseOptions options_;
+  std::string resolved_topic_;
 
   cpp_introspection::MessagePtr introspection_;
+
+  // reused for all calls to publish()
+  ConversionPtr conversion_;
+  MessagePtr instance_;
+  std::vector<ros::SerializedMessage> batch_;
+  Outgoing outgoing_;
+
+  // In asynchronous mode publish() only converts on the Matlab thread and the publisher thread calls into roscpp.
+  // The Matlab thread is the only producer and the publisher thread the only consumer of queue_, sent messages
+  // go back through recycled_. A message that has been dropped is kept in spare_.
+  bool async_;
+  bool blocking_;
+  boost::scoped_ptr<Queue> queue_;
+  boost::scoped_ptr<Queue> recycled_;
+  OutgoingPtr spare_;
+  std::size_t queue_size_;
+  boost::thread thread_;
+
+  boost::atomic<std::size_t> sent_;
+  boost::atomic<std::size_t> dropped_;
+  std::size_t blocked_;
+  double blocked_time_;
+  std::size_t max_queued_;
+
+  // statistics of the current or last playback, updated by the playback thread under playback_mutex_
+  boost::thread playback_thread_;
+  boost::atomic<bool> playing_;
+  mutable boost::mutex playback_mutex_;
+  std::size_t scheduled_;
+  std::size_t played_;
+  double first_sent_;
+  double last_sent_;
+  double jitter_sum_;
+  double jitter_squared_sum_;
+  double jitter_max_;
 };
 
 } // namespace rosmatlab
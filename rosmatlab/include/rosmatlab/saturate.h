@@ -0,0 +1,85 @@
+//=================================================================================================
+// Copyright (c) 2013, Johannes Meyer, TU Darmstadt
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of the Flight Systems and Automatic Control group,
+//       TU Darmstadt, nor the names of its contributors may be used to
+//       endorse or promote products derived from this software without
+//       specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//=================================================================================================
+
+#ifndef ROSMATLAB_SATURATE_H
+#define ROSMATLAB_SATURATE_H
+
+#include <limits>
+#include <cmath>
+
+namespace rosmatlab {
+
+// Numeric conversions like in Matlab: floating point values are rounded to nearest and all values saturate,
+// NaN becomes 0. Used when Matlab arrays are written into message fields of another type.
+namespace saturate {
+  enum NumericKind { KIND_BOOL, KIND_INTEGER, KIND_FLOAT };
+  template <typename T> struct NumericKindOf { static const NumericKind value = std::numeric_limits<T>::is_integer ? KIND_INTEGER : KIND_FLOAT; };
+  template <> struct NumericKindOf<bool> { static const NumericKind value = KIND_BOOL; };
+}
+
+template <typename To, typename From, saturate::NumericKind ToKind = saturate::NumericKindOf<To>::value, saturate::NumericKind FromKind = saturate::NumericKindOf<From>::value>
+struct Saturate {
+  static inline To apply(From x) { return static_cast<To>(x); }
+};
+
+template <typename To, typename From, saturate::NumericKind FromKind> struct Saturate<To, From, saturate::KIND_BOOL, FromKind> {
+  static inline To apply(From x) { return x != 0; }
+};
+
+template <typename To, typename From> struct Saturate<To, From, saturate::KIND_FLOAT, saturate::KIND_FLOAT> {
+  static inline To apply(From x) {
+    if (x > std::numeric_limits<To>::max()) return std::numeric_limits<To>::infinity();
+    if (x < -std::numeric_limits<To>::max()) return -std::numeric_limits<To>::infinity();
+    return static_cast<To>(x);
+  }
+};
+
+template <typename To, typename From> struct Saturate<To, From, saturate::KIND_INTEGER, saturate::KIND_FLOAT> {
+  static inline To apply(From x) {
+    if (x != x) return 0;
+    if (x <= static_cast<From>(std::numeric_limits<To>::min())) return std::numeric_limits<To>::min();
+    if (x >= static_cast<From>(std::numeric_limits<To>::max())) return std::numeric_limits<To>::max();
+    return static_cast<To>(x < 0 ? std::ceil(x - From(0.5)) : std::floor(x + From(0.5)));
+  }
+};
+
+template <typename To, typename From> struct Saturate<To, From, saturate::KIND_INTEGER, saturate::KIND_INTEGER> {
+  static inline To apply(From x) {
+    if (std::numeric_limits<From>::is_signed && x < 0) {
+      if (!std::numeric_limits<To>::is_signed) return 0;
+      if (static_cast<long long>(x) < static_cast<long long>(std::numeric_limits<To>::min())) return std::numeric_limits<To>::min();
+    } else if (static_cast<unsigned long long>(x) > static_cast<unsigned long long>(std::numeric_limits<To>::max())) {
+      return std::numeric_limits<To>::max();
+    }
+    return static_cast<To>(x);
+  }
+};
+
+} // namespace rosmatlab
+
+#endif // ROSMATLAB_SATURATE_H
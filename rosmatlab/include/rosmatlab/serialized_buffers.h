@@ -0,0 +1,59 @@
+//=================================================================================================
+// Copyright (c) 2013, Johannes Meyer, TU Darmstadt
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of the Flight Systems and Automatic Control group,
+//       TU Darmstadt, nor the names of its contributors may be used to
+//       endorse or promote products derived from this software without
+//       specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//=================================================================================================
+
+#ifndef ROSMATLAB_SERIALIZED_BUFFERS_H
+#define ROSMATLAB_SERIALIZED_BUFFERS_H
+
+#include <rosmatlab/decoder.h>
+#include <ros/serialized_message.h>
+
+namespace rosmatlab {
+
+// Pool of buffers for messages that are serialized directly from Matlab structs. A buffer is reused as soon as
+// roscpp has released all references to it, so publishing messages of the same size does not allocate.
+class SerializedBuffers {
+public:
+  // more serialized messages queued in roscpp at the same time get their own buffer
+  static const std::size_t MAX_BUFFERS = 8;
+
+  // encodes source(index) with a length prefix into m, false if the layout of source is not supported
+  bool encode(const Decoder& encoder, const mxArray *source, std::size_t index, ros::SerializedMessage& m);
+
+  std::size_t size() const { return buffers_.size(); }
+
+private:
+  struct Buffer {
+    boost::shared_ptr<std::vector<uint8_t> > data;
+    boost::shared_array<uint8_t> array;
+  };
+  std::vector<Buffer> buffers_;
+};
+
+} // namespace rosmatlab
+
+#endif // ROSMATLAB_SERIALIZED_BUFFERS_H
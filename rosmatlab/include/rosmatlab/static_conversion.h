@@ -0,0 +1,323 @@
+//=================================================================================================
+// Copyright (c) 2013, Johannes Meyer, TU Darmstadt
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of the Flight Systems and Automatic Control group,
+//       TU Darmstadt, nor the names of its contributors may be used to
+//       endorse or promote products derived from this software without
+//       specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//=================================================================================================
+
+#ifndef ROSMATLAB_STATIC_CONVERSION_H
+#define ROSMATLAB_STATIC_CONVERSION_H
+
+#include <rosmatlab/decoder.h>
+#include <rosmatlab/exception.h>
+#include <rosmatlab/options.h>
+#include <rosmatlab/saturate.h>
+
+#include <ros/time.h>
+#include <ros/duration.h>
+#include <ros/message_traits.h>
+#include <ros/serialization.h>
+
+#include <boost/array.hpp>
+#include <boost/utility/enable_if.hpp>
+#include <boost/type_traits/is_arithmetic.hpp>
+
+#include <cstring>
+
+namespace rosmatlab {
+
+/*
+  Typed conversions for messages whose generated headers are available when the message MEX files are built
+  (see src/messages/mex_message.cpp.in). The fields are visited with the allInOne() serializer of the message,
+  so no introspection and boost::any is involved. Field names and Matlab classes are taken from the Decoder
+  and its Plan, so that the result is the same as for the decoded struct. Numeric arrays are copied from the
+  instance by Decoder::decodeArray(), which also reshapes images, MultiArrays and point clouds.
+
+  Converters are registered process-wide in the shared library rosmatlab_static_converters, as every MEX file
+  has its own copy of the static rosmatlab library.
+*/
+class StaticConverter {
+public:
+  virtual ~StaticConverter() {}
+
+  // large payloads are left to jobs if given, so the instance must stay valid until they have run
+  virtual mxArray *toMatlab(const void *instance, const Decoder& decoder, const Decoder::Plan& plan, mxArray *target = 0, std::size_t index = 0, std::size_t size = 0, Decoder::Jobs *jobs = 0) const = 0;
+
+  // false if source cannot be converted by this converter (e.g. nested messages given as matrices)
+  virtual bool fromMatlab(const mxArray *source, std::size_t index, const Decoder& decoder, void *instance) const = 0;
+
+  static const StaticConverter *find(const std::string& datatype, const std::string& md5sum);
+  static void add(const std::string& datatype, const std::string& md5sum, const StaticConverter *converter);
+};
+
+namespace static_conversion {
+
+  template <typename T> struct IsMessage : boost::integral_constant<bool, ros::message_traits::IsMessage<T>::value> {};
+
+  template <typename From, typename To> static inline void cast(const From *from, To *to, std::size_t count) {
+    for(std::size_t i = 0; i < count; ++i) to[i] = static_cast<To>(from[i]);
+  }
+
+  template <typename T> static inline void toArray(const T *values, mxArray *target, std::size_t count) {
+    void *data = mxGetData(target);
+    switch(mxGetClassID(target)) {
+      case mxDOUBLE_CLASS:  cast(values, static_cast<double *>(data), count); break;
+      case mxSINGLE_CLASS:  cast(values, static_cast<float *>(data), count); break;
+      case mxLOGICAL_CLASS: for(std::size_t i = 0; i < count; ++i) static_cast<mxLogical *>(data)[i] = (values[i] != 0); break;
+      case mxINT8_CLASS:    cast(values, static_cast<int8_t *>(data), count); break;
+      case mxUINT8_CLASS:   cast(values, static_cast<uint8_t *>(data), count); break;
+      case mxINT16_CLASS:   cast(values, static_cast<int16_t *>(data), count); break;
+      case mxUINT16_CLASS:  cast(values, static_cast<uint16_t *>(data), count); break;
+      case mxINT32_CLASS:   cast(values, static_cast<int32_t *>(data), count); break;
+      case mxUINT32_CLASS:  cast(values, static_cast<uint32_t *>(data), count); break;
+      case mxINT64_CLASS:   cast(values, static_cast<int64_t *>(data), count); break;
+      case mxUINT64_CLASS:  cast(values, static_cast<uint64_t *>(data), count); break;
+      default: break;
+    }
+  }
+
+  // saturates like Decoder::encode(), so that both paths publish the same values
+  template <typename From, typename To> static inline void saturate(const From *from, To *to, std::size_t count) {
+    for(std::size_t i = 0; i < count; ++i) to[i] = Saturate<To, From>::apply(from[i]);
+  }
+
+  template <typename T> static inline void fromArray(const mxArray *source, T *values, std::size_t count) {
+    const void *data = mxGetData(source);
+    switch(mxGetClassID(source)) {
+      case mxDOUBLE_CLASS:  saturate(static_cast<const double *>(data), values, count); break;
+      case mxSINGLE_CLASS:  saturate(static_cast<const float *>(data), values, count); break;
+      case mxLOGICAL_CLASS: saturate(static_cast<const mxLogical *>(data), values, count); break;
+      case mxINT8_CLASS:    saturate(static_cast<const int8_t *>(data), values, count); break;
+      case mxUINT8_CLASS:   saturate(static_cast<const uint8_t *>(data), values, count); break;
+      case mxINT16_CLASS:   saturate(static_cast<const int16_t *>(data), values, count); break;
+      case mxUINT16_CLASS:  saturate(static_cast<const uint16_t *>(data), values, count); break;
+      case mxINT32_CLASS:   saturate(static_cast<const int32_t *>(data), values, count); break;
+      case mxUINT32_CLASS:  saturate(static_cast<const uint32_t *>(data), values, count); break;
+      case mxINT64_CLASS:   saturate(static_cast<const int64_t *>(data), values, count); break;
+      case mxUINT64_CLASS:  saturate(static_cast<const uint64_t *>(data), values, count); break;
+      default: throw Exception("Arrays of class " + boost::lexical_cast<std::string>(mxGetClassID(source)) + " cannot be converted to numbers");
+    }
+  }
+
+  // Stream for allInOne() that sets the fields of element index of a struct array
+  class Writer {
+  public:
+    Writer(const Decoder& decoder, const Decoder::Plan& plan, mxArray *target, std::size_t index, Decoder::Jobs *jobs)
+      : decoder_(decoder), plan_(plan), target_(target), index_(index), jobs_(jobs), field_(0), number_of_fields_(mxGetNumberOfFields(target)) {}
+
+    template <typename M> static mxArray *write(const Decoder& decoder, const Decoder::Plan& plan, const M& message, mxArray *target, std::size_t index, std::size_t size, Decoder::Jobs *jobs) {
+      const std::vector<const char *>& field_names = decoder.getFieldNames();
+      if (!target) target = mxCreateStructMatrix(1, size > 0 ? size : index + 1, field_names.size(), const_cast<const char **>(field_names.data()));
+      if (mxGetNumberOfFields(target) == 0) {
+        for(std::vector<const char *>::const_iterator it = field_names.begin(); it != field_names.end(); ++it) mxAddField(target, *it);
+      }
+
+      Writer writer(decoder, plan, target, index, jobs);
+      ros::serialization::Serializer<M>::template allInOne<Writer, const M&>(writer, message);
+
+      if (plan.add_meta_data) {
+        if (mxGetFieldNumber(target, "DATATYPE") == -1) mxAddField(target, "DATATYPE");
+        mxSetField(target, index, "DATATYPE", mxCreateString(ros::message_traits::DataType<M>::value()));
+        if (mxGetFieldNumber(target, "MD5SUM") == -1) mxAddField(target, "MD5SUM");
+        mxSetField(target, index, "MD5SUM", mxCreateString(ros::message_traits::MD5Sum<M>::value()));
+      }
+      return target;
+    }
+
+    template <typename T> void next(const T& value) {
+      int fieldnum = field_;
+      const char *name = decoder_.getFieldNames()[field_];
+      if (fieldnum >= number_of_fields_ || std::strcmp(mxGetFieldNameByNumber(target_, fieldnum), name) != 0) {
+        fieldnum = mxGetFieldNumber(target_, name);
+      }
+      mxSetFieldByNumber(target_, index_, fieldnum, create(value));
+      ++field_;
+    }
+
+  private:
+    template <typename T> typename boost::enable_if<boost::is_arithmetic<T>, mxArray *>::type create(const T& value) { return createArray(&value, 1); }
+    template <typename M> typename boost::enable_if<IsMessage<M>, mxArray *>::type create(const M& value) { return createArray(&value, 1); }
+    mxArray *create(const std::string& value) { return mxCreateString(value.c_str()); }
+    mxArray *create(const ros::Time& value) { return mxCreateDoubleScalar(value.toSec()); }
+    mxArray *create(const ros::Duration& value) { return mxCreateDoubleScalar(value.toSec()); }
+    template <typename T, typename Alloc> mxArray *create(const std::vector<T, Alloc>& values) { return createArray(values.empty() ? 0 : &values[0], values.size()); }
+    template <typename T, std::size_t N> mxArray *create(const boost::array<T, N>& values) { return createArray(values.data(), N); }
+
+    template <typename T> typename boost::enable_if<boost::is_arithmetic<T>, mxArray *>::type createArray(const T *values, std::size_t count) {
+      // primitive values have the same layout in the instance as in the serialized message (empty vectors have no data)
+      if (sizeof(T) == Decoder::getSize(decoder_.getFields()[field_].type)) {
+        static const T none = T();
+        return decoder_.decodeArray(plan_, field_, target_, index_, reinterpret_cast<const uint8_t *>(count > 0 ? values : &none), count, jobs_);
+      }
+
+      mxClassID class_id = plan_.class_ids[field_];
+      mxArray *target = (class_id == mxLOGICAL_CLASS) ? mxCreateLogicalMatrix(1, count) : mxCreateUninitNumericMatrix(1, count, class_id, mxREAL);
+      toArray(values, target, count);
+      return target;
+    }
+
+    template <typename M> typename boost::enable_if<IsMessage<M>, mxArray *>::type createArray(const M *values, std::size_t count) {
+      mxArray *target = 0;
+      for(std::size_t j = 0; j < count; ++j) {
+        target = write(*decoder_.getFields()[field_].message, *plan_.children[field_], values[j], target, j, count, jobs_);
+      }
+      return target;
+    }
+
+    mxArray *createArray(const std::string *values, std::size_t count) {
+      mxArray *target = mxCreateCellMatrix(1, count);
+      for(std::size_t j = 0; j < count; ++j) mxSetCell(target, j, mxCreateString(values[j].c_str()));
+      return target;
+    }
+
+    template <typename Time> mxArray *createTimes(const Time *values, std::size_t count) {
+      mxArray *target = mxCreateDoubleMatrix(1, count, mxREAL);
+      for(std::size_t j = 0; j < count; ++j) mxGetPr(target)[j] = values[j].toSec();
+      return target;
+    }
+    mxArray *createArray(const ros::Time *values, std::size_t count) { return createTimes(values, count); }
+    mxArray *createArray(const ros::Duration *values, std::size_t count) { return createTimes(values, count); }
+
+    const Decoder& decoder_;
+    const Decoder::Plan& plan_;
+    mxArray *target_;
+    std::size_t index_;
+    Decoder::Jobs *jobs_;
+    std::size_t field_;
+    int number_of_fields_;
+  };
+
+  // Stream for allInOne() that reads the fields from element index of a struct array, missing fields keep their value
+  class Reader {
+  public:
+    Reader(const Decoder& decoder, const mxArray *source, std::size_t index)
+      : decoder_(decoder), source_(source), index_(index), field_(0), supported_(true) {}
+
+    template <typename M> static bool read(const Decoder& decoder, const mxArray *source, std::size_t index, M& message) {
+      if (!mxIsStruct(source)) return false;
+      if (index >= mxGetNumberOfElements(source)) throw Exception("Index out of bounds");
+
+      Reader reader(decoder, source, index);
+      ros::serialization::Serializer<M>::template allInOne<Reader, M&>(reader, message);
+      return reader.supported_;
+    }
+
+    template <typename T> void next(T& value) {
+      const mxArray *source = mxGetField(source_, index_, decoder_.getFieldNames()[field_]);
+      if (source && supported_) read(source, value);
+      ++field_;
+    }
+
+  private:
+    Exception error(const std::string& message) const {
+      return Exception("Failed to parse field " + decoder_.getFields()[field_].name + ": " + message);
+    }
+
+    std::size_t count(const mxArray *source) const {
+      return mxIsChar(source) ? 1 : mxGetNumberOfElements(source);
+    }
+
+    template <typename T> void read(const mxArray *source, T& value) {
+      if (count(source) != 1) throw error("Scalar field must have exactly length 1");
+      readArray(source, &value, 1);
+    }
+
+    template <typename T, typename Alloc> void read(const mxArray *source, std::vector<T, Alloc>& values) {
+      // N-D data of images and MultiArrays has to be transposed by the Decoder
+      if (decoder_.isShapedField(field_, source)) { supported_ = false; return; }
+      values.resize(count(source));
+      if (!values.empty()) readArray(source, &values[0], values.size());
+    }
+
+    template <typename T, std::size_t N> void read(const mxArray *source, boost::array<T, N>& values) {
+      if (count(source) != N) throw error("Array field must have length " + boost::lexical_cast<std::string>(N));
+      readArray(source, values.data(), N);
+    }
+
+    template <typename T> typename boost::enable_if<boost::is_arithmetic<T> >::type readArray(const mxArray *source, T *values, std::size_t count) {
+      if (!mxIsNumeric(source) && !mxIsLogical(source)) throw error("Array must be a numeric array");
+      fromArray(source, values, count);
+      if (decoder_.getFields()[field_].type == Decoder::BOOL) {
+        for(std::size_t j = 0; j < count; ++j) values[j] = (values[j] != 0);
+      }
+    }
+
+    template <typename M> typename boost::enable_if<IsMessage<M> >::type readArray(const mxArray *source, M *values, std::size_t count) {
+      if (!mxIsStruct(source)) { supported_ = false; return; }
+      const Decoder& child = *decoder_.getFields()[field_].message;
+      for(std::size_t j = 0; j < count && supported_; ++j) {
+        supported_ = read(child, source, j, values[j]);
+      }
+    }
+
+    void readArray(const mxArray *source, std::string *values, std::size_t count) {
+      for(std::size_t j = 0; j < count; ++j) {
+        if (mxIsCell(source) && mxIsChar(mxGetCell(source, j))) {
+          values[j] = Options::getString(mxGetCell(source, j));
+        } else if (mxIsChar(source) && j == 0) {
+          values[j] = Options::getString(source);
+        } else {
+          throw error("Array must be a cell string or a character array");
+        }
+      }
+    }
+
+    template <typename Time> void readTimes(const mxArray *source, Time *values, std::size_t count) {
+      std::vector<double> x(count);
+      readArray(source, x.data(), count);
+      for(std::size_t j = 0; j < count; ++j) values[j] = Time(x[j]);
+    }
+    void readArray(const mxArray *source, ros::Time *values, std::size_t count) { readTimes(source, values, count); }
+    void readArray(const mxArray *source, ros::Duration *values, std::size_t count) { readTimes(source, values, count); }
+
+    const Decoder& decoder_;
+    const mxArray *source_;
+    std::size_t index_;
+    std::size_t field_;
+    bool supported_;
+  };
+
+} // namespace static_conversion
+
+template <typename M>
+class StaticConverterT : public StaticConverter {
+public:
+  mxArray *toMatlab(const void *instance, const Decoder& decoder, const Decoder::Plan& plan, mxArray *target, std::size_t index, std::size_t size, Decoder::Jobs *jobs) const {
+    return static_conversion::Writer::write(decoder, plan, *static_cast<const M *>(instance), target, index, size, jobs);
+  }
+
+  bool fromMatlab(const mxArray *source, std::size_t index, const Decoder& decoder, void *instance) const {
+    return static_conversion::Reader::read(decoder, source, index, *static_cast<M *>(instance));
+  }
+};
+
+// called by the generated message MEX files
+template <typename M> void addStaticConverter() {
+  static StaticConverterT<M> converter;
+  StaticConverter::add(ros::message_traits::DataType<M>::value(), ros::message_traits::MD5Sum<M>::value(), &converter);
+}
+
+} // namespace rosmatlab
+
+#endif // ROSMATLAB_STATIC_CONVERSION_H
@@ -30,17 +30,22 @@
 #define ROSMATLAB_SUBSCRIBER_H
 
 #include <rosmatlab/object.h>
+#include <rosmatlab/handoff.h>
 #include <ros/ros.h>
-#include <ros/callback_queue.h>
 
 #include <introspection/forwards.h>
 
+#include <boost/atomic.hpp>
+#include <boost/scoped_ptr.hpp>
+
 namespace rosmatlab {
 
 using cpp_introspection::VoidPtr;
 using cpp_introspection::VoidConstPtr;
 using cpp_introspection::MessagePtr;
 
+class Conversion;
+
 class Subscriber : public ros::Subscriber, public Object<Subscriber>
 {
 public:
@@ -60,23 +65,33 @@ public:
   mxArray *getReceiptTime() const;
 
   mxArray *getNumPublishers() const;
+  mxArray *getStatistics() const;
 
 private:
   friend class SubscriptionCallbackHelper;
   typedef ros::MessageEvent<void> MessageEvent;
   typedef boost::shared_ptr<MessageEvent> MessageEventPtr;
+  typedef Handoff<MessageEventPtr> Buffer;
   void callback(const MessageEvent& event);
-  MessagePtr introspect(const VoidConstPtr& msg);
+  bool wait(const ros::WallDuration& timeout);
+  mxArray *convert(Conversion& conversion, const MessageEventPtr& event, mxArray *target = 0, std::size_t index = 0, std::size_t size = 0);
 
 private:
   ros::NodeHandle node_handle_;
   ros::SubscribeOptions options_;
-  ros::CallbackQueue callback_queue_;
   ros::WallDuration timeout_;
+  bool lazy_;
 
   cpp_introspection::MessagePtr introspection_;
-  MessageEventPtr new_event_;
+
+  // The spinner thread is the only producer and the Matlab thread the only consumer of buffer_.
+  boost::scoped_ptr<Buffer> buffer_;
+  std::size_t buffer_size_;
   MessageEventPtr last_event_;
+
+  boost::atomic<std::size_t> received_;
+  boost::atomic<std::size_t> dropped_;
+  std::size_t dropped_reported_;
 };
 
 } // namespace rosmatlab
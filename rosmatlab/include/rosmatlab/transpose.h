@@ -0,0 +1,53 @@
+//=================================================================================================
+// Copyright (c) 2013, Johannes Meyer, TU Darmstadt
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of the Flight Systems and Automatic Control group,
+//       TU Darmstadt, nor the names of its contributors may be used to
+//       endorse or promote products derived from this software without
+//       specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//=================================================================================================
+
+#ifndef ROSMATLAB_TRANSPOSE_H
+#define ROSMATLAB_TRANSPOSE_H
+
+#include <rosmatlab/decoder.h>
+
+namespace rosmatlab {
+
+// Copy a rows x columns matrix between two strided layouts, e.g. from the row-major data of ROS messages
+// into column-major Matlab arrays and back. Element (r,c) is located at r * row + c * column bytes.
+// The matrix is processed in cache-sized blocks, 8 and 32 bit elements use SSE2 tiles if available.
+void transpose(uint8_t *target, std::size_t target_row, std::size_t target_column,
+               const uint8_t *source, std::size_t source_row, std::size_t source_column,
+               std::size_t rows, std::size_t columns, std::size_t element_size);
+
+// the same with conversion from and to double elements
+void transposeToDouble(uint8_t *target, std::size_t target_row, std::size_t target_column,
+                       const uint8_t *source, std::size_t source_row, std::size_t source_column,
+                       std::size_t rows, std::size_t columns, Decoder::FieldType source_type);
+void transposeFromDouble(uint8_t *target, std::size_t target_row, std::size_t target_column,
+                         const uint8_t *source, std::size_t source_row, std::size_t source_column,
+                         std::size_t rows, std::size_t columns, Decoder::FieldType target_type);
+
+} // namespace rosmatlab
+
+#endif // ROSMATLAB_TRANSPOSE_H
@@ -13,6 +13,7 @@ classdef Publisher < handle
 
     properties (SetAccess = private, Dependent)
         NumSubscribers
+        Statistics
     end
 
     properties
@@ -48,8 +49,20 @@ classdef Publisher < handle
             internal(obj, 'publish', varargin{:});
         end
 
+        function schedule(obj, data, timestamps, varargin)
+            internal(obj, 'schedule', data, timestamps, varargin{:});
+        end
+
+        function cancel(obj)
+            internal(obj, 'cancel');
+        end
+
         function result = get.NumSubscribers(obj)
             result = internal(obj, 'getNumSubscribers');
         end
+
+        function result = get.Statistics(obj)
+            result = internal(obj, 'getStatistics');
+        end
     end
 end
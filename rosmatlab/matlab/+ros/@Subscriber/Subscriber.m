@@ -13,10 +13,12 @@ classdef Subscriber < handle
 
     properties (SetAccess = private, Dependent)
         NumPublishers
+        Statistics
     end
 
     properties
         PollPeriod = 0.01
+        MaxDispatch = 100
         UserData
     end
 
@@ -27,7 +29,7 @@ classdef Subscriber < handle
     methods
         function obj = Subscriber(varargin)
             obj.handle = internal(obj, 'create', varargin{:});
-            obj.poll_timer = timer('ExecutionMode', 'fixedDelay', 'ObjectVisibility', 'off', 'TimerFcn', @(~,~) obj.poll(0));
+            obj.poll_timer = timer('ExecutionMode', 'fixedDelay', 'ObjectVisibility', 'off', 'TimerFcn', @(~,~) obj.dispatch());
 
             obj.Topic    = internal(obj, 'getTopic');
             obj.DataType = internal(obj, 'getDataType');
@@ -63,6 +65,14 @@ classdef Subscriber < handle
             if (~isempty(message)); notify(obj, 'Callback', ros.MessageEvent(message, obj.Topic, obj.DataType, obj.MD5Sum)); end
         end
 
+        function dispatch(obj)
+            % deliver at most MaxDispatch buffered messages per timer tick, so that a topic that is published
+            % faster than the callbacks return does not keep the timer from handing control back to Matlab
+            for i = 1:obj.MaxDispatch
+                if isempty(obj.poll(0)); break; end
+            end
+        end
+
         function result = getConnectionHeader(obj)
             result = internal(obj, 'getConnectionHeader');
         end
@@ -75,6 +85,10 @@ classdef Subscriber < handle
             result = internal(obj, 'getNumPublishers');
         end
 
+        function result = get.Statistics(obj)
+            result = internal(obj, 'getStatistics');
+        end
+
         function set.PollPeriod(obj, period)
             obj.stop();
             obj.PollPeriod = period;
@@ -0,0 +1,171 @@
+//=================================================================================================
+// Copyright (c) 2013, Johannes Meyer, TU Darmstadt
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of the Flight Systems and Automatic Control group,
+//       TU Darmstadt, nor the names of its contributors may be used to
+//       endorse or promote products derived from this software without
+//       specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//=================================================================================================
+#include <rosmatlab/compressed_image.h>
+#include <rosmatlab/transpose.h>
+
+#include <vector>
+#include <cstring>
+#include <cstdio>
+#include <csetjmp>
+
+#ifdef ROSMATLAB_HAVE_JPEG
+  #include <jpeglib.h>
+#endif
+#ifdef ROSMATLAB_HAVE_PNG
+  #include <png.h>
+  #if PNG_LIBPNG_VER < 10600
+    #undef ROSMATLAB_HAVE_PNG
+  #endif
+#endif
+
+namespace rosmatlab {
+
+namespace {
+#ifdef ROSMATLAB_HAVE_JPEG
+  // libjpeg calls exit() on errors by default
+  struct JPEGError {
+    jpeg_error_mgr manager;
+    std::jmp_buf jump;
+  };
+
+  static void onJPEGError(j_common_ptr info) {
+    std::longjmp(reinterpret_cast<JPEGError *>(info->err)->jump, 1);
+  }
+
+  static void onJPEGMessage(j_common_ptr, int) {}
+
+  static bool isJPEG(const uint8_t *data, std::size_t length) {
+    return length >= 3 && data[0] == 0xFF && data[1] == 0xD8 && data[2] == 0xFF;
+  }
+
+  // reads the header only if pixels is null, otherwise decodes interleaved rows into pixels
+  static bool decodeJPEG(const uint8_t *data, std::size_t length, uint8_t *pixels, std::size_t& height, std::size_t& width, std::size_t& channels) {
+    jpeg_decompress_struct info;
+    JPEGError error;
+    info.err = jpeg_std_error(&error.manager);
+    error.manager.error_exit = onJPEGError;
+    error.manager.emit_message = onJPEGMessage;
+    jpeg_create_decompress(&info);
+
+    if (setjmp(error.jump)) {
+      jpeg_destroy_decompress(&info);
+      return false;
+    }
+
+    jpeg_mem_src(&info, const_cast<uint8_t *>(data), length);
+    jpeg_read_header(&info, TRUE);
+    if (info.num_components != 1 && info.num_components != 3) {
+      jpeg_destroy_decompress(&info);
+      return false;
+    }
+    info.out_color_space = (info.num_components == 1) ? JCS_GRAYSCALE : JCS_RGB;
+
+    if (!pixels) {
+      height = info.image_height;
+      width = info.image_width;
+      channels = info.num_components;
+      jpeg_destroy_decompress(&info);
+      return true;
+    }
+
+    if (info.image_height != height || info.image_width != width || static_cast<std::size_t>(info.num_components) != channels) {
+      jpeg_destroy_decompress(&info);
+      return false;
+    }
+
+    jpeg_start_decompress(&info);
+    while(info.output_scanline < info.output_height) {
+      JSAMPROW row = pixels + info.output_scanline * width * channels;
+      jpeg_read_scanlines(&info, &row, 1);
+    }
+    jpeg_finish_decompress(&info);
+    jpeg_destroy_decompress(&info);
+    return true;
+  }
+#endif // ROSMATLAB_HAVE_JPEG
+
+#ifdef ROSMATLAB_HAVE_PNG
+  static bool isPNG(const uint8_t *data, std::size_t length) {
+    static const uint8_t signature[] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+    return length >= sizeof(signature) && std::memcmp(data, signature, sizeof(signature)) == 0;
+  }
+
+  // the same for PNG with the simplified API of libpng 1.6, 16 bit images are reduced to 8 bit
+  static bool decodePNG(const uint8_t *data, std::size_t length, uint8_t *pixels, std::size_t& height, std::size_t& width, std::size_t& channels) {
+    png_image image;
+    std::memset(&image, 0, sizeof(image));
+    image.version = PNG_IMAGE_VERSION;
+    if (!png_image_begin_read_from_memory(&image, data, length)) return false;
+    image.format &= PNG_FORMAT_FLAG_COLOR | PNG_FORMAT_FLAG_ALPHA;
+
+    if (!pixels) {
+      height = image.height;
+      width = image.width;
+      channels = PNG_IMAGE_SAMPLE_CHANNELS(image.format);
+      png_image_free(&image);
+      return true;
+    }
+
+    if (image.height != height || image.width != width || PNG_IMAGE_SAMPLE_CHANNELS(image.format) != channels) {
+      png_image_free(&image);
+      return false;
+    }
+
+    return png_image_finish_read(&image, 0, pixels, 0, 0) != 0;
+  }
+#endif // ROSMATLAB_HAVE_PNG
+
+  static bool decode(const uint8_t *data, std::size_t length, uint8_t *pixels, std::size_t& height, std::size_t& width, std::size_t& channels) {
+#ifdef ROSMATLAB_HAVE_JPEG
+    if (isJPEG(data, length)) return decodeJPEG(data, length, pixels, height, width, channels);
+#endif
+#ifdef ROSMATLAB_HAVE_PNG
+    if (isPNG(data, length)) return decodePNG(data, length, pixels, height, width, channels);
+#endif
+    return false;
+  }
+}
+
+bool readImageHeader(const uint8_t *data, std::size_t length, std::size_t& height, std::size_t& width, std::size_t& channels)
+{
+  return decode(data, length, 0, height, width, channels);
+}
+
+bool decompressImage(const uint8_t *data, std::size_t length, uint8_t *target, std::size_t height, std::size_t width, std::size_t channels)
+{
+  // decode into interleaved rows and split them into one column-major plane per channel
+  std::vector<uint8_t> pixels(height * width * channels);
+  if (pixels.empty() || !decode(data, length, pixels.data(), height, width, channels)) return false;
+
+  for(std::size_t c = 0; c < channels; ++c) {
+    transpose(target + c * height * width, 1, height, pixels.data() + c, width * channels, channels, height, width, 1);
+  }
+  return true;
+}
+
+} // namespace rosmatlab
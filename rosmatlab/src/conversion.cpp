@@ -29,6 +29,7 @@
 #include <rosmatlab/conversion.h>
 #include <rosmatlab/exception.h>
 #include <rosmatlab/log.h>
+#include <rosmatlab/static_conversion.h>
 
 #include <introspection/message.h>
 #include <introspection/type.h>
@@ -37,6 +38,8 @@
 #include <ros/duration.h>
 
 #include <stdio.h>
+#include <cstring>
+#include <algorithm>
 #include <ros/message_traits.h>
 #include <boost/algorithm/string.hpp>
 
@@ -44,22 +47,81 @@
 
 namespace rosmatlab {
 
-Conversion::Conversion(const MessagePtr &message) : message_(message), options_(defaultOptions())
+namespace {
+  template <typename T> static double getDouble(ConstArray source, std::size_t i) {
+    return static_cast<double>(static_cast<const T *>(mxGetData(source))[i]);
+  }
+
+  static double getDouble(ConstArray source, std::size_t i) {
+    switch(mxGetClassID(source)) {
+      case mxDOUBLE_CLASS:  return getDouble<double>(source, i);
+      case mxSINGLE_CLASS:  return getDouble<float>(source, i);
+      case mxLOGICAL_CLASS: return getDouble<mxLogical>(source, i);
+      case mxINT8_CLASS:    return getDouble<int8_t>(source, i);
+      case mxUINT8_CLASS:   return getDouble<uint8_t>(source, i);
+      case mxINT16_CLASS:   return getDouble<int16_t>(source, i);
+      case mxUINT16_CLASS:  return getDouble<uint16_t>(source, i);
+      case mxINT32_CLASS:   return getDouble<int32_t>(source, i);
+      case mxUINT32_CLASS:  return getDouble<uint32_t>(source, i);
+      case mxINT64_CLASS:   return getDouble<int64_t>(source, i);
+      case mxUINT64_CLASS:  return getDouble<uint64_t>(source, i);
+      default:              return 0.0;
+    }
+  }
+
+  template <typename T> static void fillNative(const FieldPtr& field, void *data) {
+    T *x = static_cast<T *>(data);
+    for(std::size_t i = 0; i < field->size(); i++) {
+      x[i] = boost::any_cast<T>(field->get(i));
+    }
+  }
+
+  // address of the instance of element j of a nested message field
+  const uint8_t *getElement(const FieldPtr& field, std::size_t j) {
+    MessagePtr element = field->expand(j);
+    return element ? static_cast<const uint8_t *>(element->getConstInstance().get()) : 0;
+  }
+
+  // dictionary-encoded strings of a single conversion form a batch of their own
+  class LocalJobs {
+  public:
+    LocalJobs(Conversion& conversion) : conversion_(conversion) { conversion_.setJobs(&jobs_); }
+    ~LocalJobs() { conversion_.setJobs(0); }
+    void finish() { conversion_.setJobs(0); jobs_.finish(); }
+
+  private:
+    Conversion& conversion_;
+    Decoder::Jobs jobs_;
+  };
+}
+
+Conversion::Conversion(const MessagePtr &message) : message_(message), decoder_checked_(false), converter_(0), encoder_checked_(false), jobs_(0), flattener_checked_(false), matrix_(0), matrix_data_(0), matrix_capacity_(0), options_(defaultOptions())
 {
   options_.merge(perMessageOptions(message));
+  settings_ = options_.snapshot();
 }
 
-Conversion::Conversion(const MessagePtr &message, const ConversionOptions& options) : message_(message), options_(defaultOptions())
+Conversion::Conversion(const MessagePtr &message, const ConversionOptions& options) : message_(message), decoder_checked_(false), converter_(0), encoder_checked_(false), jobs_(0), flattener_checked_(false), matrix_(0), matrix_data_(0), matrix_capacity_(0), options_(defaultOptions())
 {
   options_.merge(perMessageOptions(message));
   options_.merge(options);
+  settings_ = options_.snapshot();
 }
 
 Conversion::Conversion(const Conversion &other, const MessagePtr &message)
   : message_(message ? message : other.message_)
+  , decoder_checked_(false)
+  , converter_(0)
+  , encoder_checked_(false)
+  , jobs_(other.jobs_)
+  , flattener_checked_(false)
+  , matrix_(0)
+  , matrix_data_(0)
+  , matrix_capacity_(0)
   , options_(other.options_)
 {
   options_.merge(perMessageOptions(message));
+  settings_ = options_.snapshot();
 }
 
 Conversion::~Conversion() {}
@@ -69,16 +131,94 @@ Array Conversion::toMatlab() {
 }
 
 Array Conversion::toMatlab(Array target, std::size_t index, std::size_t size) {
-  switch(options_.conversionType()) {
+  if (needsLocalJobs(size)) {
+    LocalJobs jobs(*this);
+    target = toMatlab(target, index, size);
+    jobs.finish();
+    return target;
+  }
+
+  switch(settings_.type) {
     case ConversionOptions::MATLAB_STRUCT:
+      if (canDecode() && message_->getConstInstance()) return decode(target, index, size);
       return toStruct(target, index, size);
     case ConversionOptions::MATLAB_MATRIX:
       return toDoubleMatrix(target, index, size);
     case ConversionOptions::MATLAB_EXTENDED_STRUCT:
       return toExtendedStruct(target, index, size);
+    case ConversionOptions::MATLAB_COLUMNAR:
+      if (canDecode() && message_->getConstInstance()) return decode(target, index, size);
+      throw Exception("Messages of type " + std::string(message_->getDataType()) + " cannot be converted to columns");
+    default:
+      break;
+  }
+
+  throw Exception("Unsupported conversion type " + boost::lexical_cast<std::string>(settings_.type));
+}
+
+// Dictionary-encoded strings are interned per batch. A single message gets jobs of its own, batches of several
+// messages have to share theirs (see setJobs()), else every message would get a dictionary of its own.
+bool Conversion::needsLocalJobs(std::size_t size) const {
+  if (jobs_ || settings_.strings == ConversionOptions::STRINGS_CHAR) return false;
+  if (size > 1) throw Exception("Dictionary-encoded strings of a batch of " + boost::lexical_cast<std::string>(size) + " messages need jobs, see Conversion::setJobs()");
+  return true;
+}
+
+bool Conversion::canDecode() {
+  if (!decoder_checked_) {
+    decoder_ = Decoder::forMessage(message_);
+    if (decoder_) plan_ = decoder_->compile(settings_);
+    converter_ = decoder_ ? StaticConverter::find(message_->getDataType(), message_->getMD5Sum()) : 0;
+    if (decoder_ && !plan_->supported) decoder_.reset();
+    decoder_checked_ = true;
+  }
+  return decoder_.get() != 0;
+}
+
+Array Conversion::toMatlab(ros::serialization::IStream& stream, Array target, std::size_t index, std::size_t size) {
+  if (needsLocalJobs(size)) {
+    LocalJobs jobs(*this);
+    target = toMatlab(stream, target, index, size);
+    jobs.finish();
+    return target;
+  }
+
+  try {
+    if (canDecode()) return decoder_->decode(stream, *plan_, target, index, size, jobs_);
+
+    // fall back to deserialization if the message cannot be decoded directly
+    VoidPtr instance = message_->deserialize(stream);
+    if (!instance) throw Exception("deserialization of a message of type " + std::string(message_->getDataType()) + " failed");
+    return setMessage(message_->introspect(instance)).toMatlab(target, index, size);
+
+  } catch(ros::serialization::StreamOverrunException& e) {
+    throw Exception("deserialization of a message of type " + std::string(message_->getDataType()) + " failed: " + e.what());
   }
+}
 
-  throw Exception("Unsupported conversion type " + boost::lexical_cast<std::string>(options_.conversionType()));
+// Converting an instance field by field via boost::any is slow for large primitive arrays (images, point clouds, ...).
+// Serializing it is basically a memcpy of those arrays, which the decoder then copies into Matlab arrays in bulk.
+Array Conversion::decode(Array target, std::size_t index, std::size_t size) {
+  // messages with a static converter are converted directly from the typed instance, including their payloads
+  if (converter_ && !plan_->columnar) return converter_->toMatlab(message_->getConstInstance().get(), *decoder_, *plan_, target, index, size, jobs_);
+
+  // fall back to serializing the instance for messages without a static converter
+  std::vector<uint8_t>& buffer = jobs_ ? jobs_->hold(0) : buffer_;
+  serialize(buffer);
+  ros::serialization::IStream istream(buffer.data(), buffer.size());
+  return decoder_->decode(istream, *plan_, target, index, size, jobs_);
+}
+
+void Conversion::serialize(std::vector<uint8_t>& buffer) {
+  VoidConstPtr instance = message_->getConstInstance();
+  buffer.resize(message_->serializationLength(instance));
+  ros::serialization::OStream ostream(buffer.data(), buffer.size());
+  message_->serialize(ostream, instance);
+}
+
+Conversion &Conversion::setJobs(Decoder::Jobs *jobs) {
+  jobs_ = jobs;
+  return *this;
 }
 
 Array Conversion::toDoubleMatrix() {
@@ -86,28 +226,96 @@ Array Conversion::toDoubleMatrix() {
 }
 
 Array Conversion::toDoubleMatrix(Array target, std::size_t index, std::size_t size) {
-  if (!target) target = mxCreateDoubleMatrix(expanded()->size(), size > 0 ? size : index + 1, mxREAL);
+  return toDoubleMatrix(target, index, size, 0);
+}
 
-  bool do_realloc = false;
-  if (mxGetM(target) < expanded()->size()) { mxSetM(target, expanded()->size()); do_realloc = true; }
-  if (mxGetN(target) < index + 1) { mxSetN(target, index + 1); do_realloc = true; }
-  if (do_realloc)
-  {
-    mxSetData(target, mxRealloc(mxGetData(target), mxGetN(target) * mxGetN(target) * sizeof(double)));
+Array Conversion::toDoubleMatrix(Array target, std::size_t index, std::size_t size, std::vector<std::string> *strings) {
+  std::size_t rows = canFlatten() ? flattener_->getFlatSize() : expanded()->size();
+  if (!target) {
+    target = mxCreateDoubleMatrix(rows, size > 0 ? size : index + 1, mxREAL);
+    matrix_ = target;
+    matrix_data_ = mxGetData(target);
+    matrix_capacity_ = mxGetN(target);
   }
+  if (mxGetM(target) < rows || mxGetN(target) < index + 1) resizeDoubleMatrix(target, rows, index + 1);
 
   double *data = mxGetPr(target) + mxGetM(target) * index;
+  if (canFlatten()) {
+    serialize(buffer_);
+    ros::serialization::IStream stream(buffer_.data(), buffer_.size());
+    flattener_->flatten(stream, data, strings);
+    return target;
+  }
+
   for(Message::const_iterator field = expanded()->begin(); field != expanded()->end(); ++field) {
     // if (!(*field)->getType()->isNumeric()) continue;
     *data++ = (*field)->getType()->as_double((*field)->get());
+    if (strings && (*field)->getType()->isString()) strings->push_back((*field)->getType()->as_string((*field)->get()));
   }
   return target;
 }
 
+// grow the matrix to at least rows x columns, columns are allocated geometrically if the matrix is filled column by column
+// the spare capacity is only trusted for the array and data block that were allocated last, as Matlab may reuse addresses
+void Conversion::resizeDoubleMatrix(Array target, std::size_t rows, std::size_t columns) {
+  std::size_t m = mxGetM(target);
+  std::size_t n = mxGetN(target);
+  bool known = (target == matrix_ && mxGetData(target) == matrix_data_ && n <= matrix_capacity_);
+  std::size_t capacity = known ? matrix_capacity_ : n;
+  std::size_t new_m = std::max(m, rows);
+  std::size_t new_n = std::max(n, columns);
+
+  if (new_m != m || new_n > capacity) {
+    capacity = std::max(new_n, 2 * capacity);
+    double *data = static_cast<double *>(mxCalloc(new_m * capacity, sizeof(double)));
+    for(std::size_t j = 0; j < n; ++j) {
+      std::memcpy(data + j * new_m, mxGetPr(target) + j * m, m * sizeof(double));
+    }
+    mxFree(mxGetData(target));
+    mxSetData(target, data);
+  }
+
+  mxSetM(target, new_m);
+  mxSetN(target, new_n);
+  matrix_ = target;
+  matrix_data_ = mxGetData(target);
+  matrix_capacity_ = capacity;
+}
+
+// the flattened layout of the decoder replaces expand() for messages without variable-length arrays
+bool Conversion::canFlatten() {
+  if (!flattener_checked_) {
+    flattener_ = message_->getConstInstance() ? Decoder::forMessage(message_) : DecoderConstPtr();
+    if (flattener_ && flattener_->needsFlatVerification()) flattener_->verifyFlatLayout(expanded()->size());
+    if (flattener_ && !flattener_->isFlat()) flattener_.reset();
+    flattener_checked_ = true;
+  }
+  return flattener_.get() != 0;
+}
+
 Array Conversion::toStruct() {
   return toStruct(0);
 }
 
+// Conversion of the nested message field at position, reused for all messages. It inherits the same options as the
+// nested plans in Decoder::compile().
+Conversion& Conversion::getChild(std::size_t position, const MessagePtr& message) {
+  if (children_.size() <= position) children_.resize(position + 1);
+  ConversionPtr& child = children_[position];
+  if (!child || std::strcmp(child->message_->getDataType(), message->getDataType()) != 0) {
+    child.reset(new Conversion(message));
+    child->options_
+        .setNumericType(settings_.numeric)
+        .setStringType(settings_.strings)
+        .setReshapeArrays(settings_.reshape)
+        .setPointCloudType(settings_.pointcloud)
+        .setRemoveNaN(settings_.remove_nan)
+        .setDecompressImages(settings_.decompress);
+    child->settings_ = child->options_.snapshot();
+  }
+  return child->setJobs(jobs_);
+}
+
 Array Conversion::toStruct(Array target, std::size_t index, std::size_t size) {
 //  ROSMATLAB_PRINTF("Constructing message %s (%s)...", message_->getName(), message_->getDataType());
 
@@ -124,41 +332,68 @@ Array Conversion::toStruct(Array target, std::size_t index, std::size_t size) {
   }
 
   // iterate through all fields
-  for(Message::const_iterator field = message_->begin(); field != message_->end(); ++field) {
+  int number_of_fields = mxGetNumberOfFields(target);
+  int position = 0;
+  for(Message::const_iterator field = message_->begin(); field != message_->end(); ++field, ++position) {
     const char *field_name = (*field)->getName();
+    int fieldnum = position;
+    if (fieldnum >= number_of_fields || std::strcmp(mxGetFieldNameByNumber(target, fieldnum), field_name) != 0) {
+      fieldnum = mxGetFieldNumber(target, field_name);
+    }
 
     if ((*field)->isMessage()) {
       MessagePtr field_message = messageByDataType((*field)->getValueType());
 
       if (field_message) {
         Array child = 0; /* mxCreateStructMatrix(1, (*field)->size(), field_message->getFieldNames().size(), const_cast<const char **>(field_message->getFieldNames().data())); */
+        Conversion& child_conversion = getChild(position, field_message);
+        std::size_t count = (*field)->size();
+
+        // The elements of nested arrays are contiguous. If the child has a static converter, only the first, second
+        // and last element are expanded to find their stride and all elements are converted from the instance.
+        MessagePtr first = (count > 0) ? (*field)->expand(0) : MessagePtr();
+        const uint8_t *begin = 0;
+        std::ptrdiff_t stride = 0;
+        if (first && child_conversion.setMessage(first).canDecode() && child_conversion.converter_ && !child_conversion.plan_->columnar) {
+          begin = static_cast<const uint8_t *>(first->getConstInstance().get());
+          if (count > 1) {
+            const uint8_t *second = getElement(*field, 1);
+            stride = second ? second - begin : 0;
+            if (stride <= 0 || getElement(*field, count - 1) != begin + (count - 1) * stride) begin = 0;
+          }
+        }
 
-        // iterate over array
-        for(std::size_t j = 0; j < (*field)->size(); j++) {
-//          ROSMATLAB_PRINTF("Expanding field %s[%u] (%s)...", (*field)->getName(), j, (*field)->getDataType());
-          MessagePtr expanded = (*field)->expand(j);
-          if (expanded) {
-            child = Conversion(expanded).toMatlab(child, j, (*field)->size());
-          } else {
-            ROSMATLAB_PRINTF("Error during expansion of %s[%u] (%s)...", (*field)->getName(), j, (*field)->getDataType());
+        if (begin) {
+          for(std::size_t j = 0; j < count; j++) {
+            child = child_conversion.converter_->toMatlab(begin + j * stride, *child_conversion.decoder_, *child_conversion.plan_, child, j, count, jobs_);
+          }
+        } else {
+          for(std::size_t j = 0; j < count; j++) {
+//            ROSMATLAB_PRINTF("Expanding field %s[%u] (%s)...", (*field)->getName(), j, (*field)->getDataType());
+            MessagePtr expanded = (j == 0) ? first : (*field)->expand(j);
+            if (expanded) {
+              child = child_conversion.setMessage(expanded).toMatlab(child, j, count);
+            } else {
+              ROSMATLAB_PRINTF("Error during expansion of %s[%u] (%s)...", (*field)->getName(), j, (*field)->getDataType());
+            }
           }
         }
 
-        mxSetField(target, index, field_name, child);
+        mxSetFieldByNumber(target, index, fieldnum, child);
 
       } else {
         ROSMATLAB_PRINTF("Error during conversion of field %s[%u] (%s): unknown datatype", (*field)->getName(), (*field)->size(), (*field)->getDataType());
         const char **field_names = { 0 };
-        mxSetField(target, index, field_name, mxCreateStructMatrix(1, (*field)->size(), 0, field_names));
+        mxSetFieldByNumber(target, index, fieldnum, mxCreateStructMatrix(1, (*field)->size(), 0, field_names));
       }
 
     } else {
-      mxSetField(target, index, field_name, convertToMatlab(*field));
+      mxSetFieldByNumber(target, index, fieldnum, convertToMatlab(*field));
     }
   }
 
   // add meta data to the struct
-  if (options_.addMetaData()) {
+  if (settings_.add_meta_data) {
     if (mxGetFieldNumber(target, "DATATYPE") == -1) mxAddField(target, "DATATYPE");
     mxSetField(target, index, "DATATYPE", mxCreateString(message_->getDataType()));
     if (mxGetFieldNumber(target, "MD5SUM") == -1) mxAddField(target, "MD5SUM");
@@ -173,6 +408,13 @@ Array Conversion::toExtendedStruct() {
 }
 
 Array Conversion::toExtendedStruct(Array target, std::size_t index, std::size_t size) {
+  if (needsLocalJobs(size)) {
+    LocalJobs jobs(*this);
+    target = toExtendedStruct(target, index, size);
+    jobs.finish();
+    return target;
+  }
+
   static const char *fieldnames[] = { "count", "stamps", "data", "fields", "strings", "string_fields" /*, "arrays", "array_fields" */ };
   if (!target) target = mxCreateStructMatrix(1, 1, sizeof(fieldnames)/sizeof(*fieldnames), fieldnames);
 
@@ -189,8 +431,9 @@ Array Conversion::toExtendedStruct(Array target, std::size_t index, std::size_t
   }
 
   // set data
+  std::vector<std::string> string_values;
   mxArray *data = mxGetField(target, 0, "data");
-  data = toDoubleMatrix(data, index, size);
+  data = toDoubleMatrix(data, index, size, &string_values);
   mxSetField(target, 0, "data", data);
 
   // set fields
@@ -208,37 +451,35 @@ Array Conversion::toExtendedStruct(Array target, std::size_t index, std::size_t
   mxArray *strings = mxGetField(target, 0, "strings");
   mxArray *string_fields = mxGetField(target, 0, "string_fields");
 
-  std::size_t string_count = 0;
-  for(Message::const_iterator field_it = expanded()->begin(); field_it != expanded()->end(); ++field_it) {
-    const FieldPtr& field = *field_it;
-    if (field->getType()->isString()) string_count++;
-  }
-
+  std::size_t string_count = string_values.size();
   if (string_count > 0) {
     if (!string_fields) {
       string_fields = mxCreateCellMatrix(string_count, 1);
       std::size_t string_index = 0;
-      for(Message::const_iterator field_it = expanded()->begin(); field_it != expanded()->end(); ++field_it, ++string_index) {
+      for(Message::const_iterator field_it = expanded()->begin(); field_it != expanded()->end(); ++field_it) {
         const FieldPtr& field = *field_it;
         if (!field->getType()->isString()) continue;
-        mxSetCell(string_fields, string_index, mxCreateString(field->getName()));
+        mxSetCell(string_fields, string_index++, mxCreateString(field->getName()));
       }
     }
 
+    bool dictionary = (settings_.strings != ConversionOptions::STRINGS_CHAR);
     if (!strings) {
-      strings = mxCreateCellMatrix(string_count, size);
+      strings = dictionary ? mxCreateNumericMatrix(string_count, size, mxUINT32_CLASS, mxREAL) : mxCreateCellMatrix(string_count, size);
+      mxSetField(target, 0, "strings", strings);
     } else if (mxGetM(strings) < string_count) {
       throw Exception("string_fields cell has wrong size");
     }
 
-    std::size_t string_index = 0;
-    for(Message::const_iterator field_it = expanded()->begin(); field_it != expanded()->end(); ++field_it, ++string_index) {
-      const FieldPtr& field = *field_it;
-      if (!field->getType()->isString()) continue;
-      mxSetCell(strings, index * string_count + string_index, mxCreateString(field->getType()->as_string(field->get(0)).c_str()));
+    for(std::size_t string_index = 0; string_index < string_count; ++string_index) {
+      if (dictionary) {
+        static_cast<uint32_t *>(mxGetData(strings))[index * string_count + string_index] =
+            jobs_->intern(target, "strings", strings, string_values[string_index], settings_.strings == ConversionOptions::STRINGS_CATEGORICAL);
+      } else {
+        mxSetCell(strings, index * string_count + string_index, mxCreateString(string_values[string_index].c_str()));
+      }
     }
 
-    mxSetField(target, 0, "strings", strings);
     mxSetField(target, 0, "string_fields", string_fields);
   }
 
@@ -265,13 +506,75 @@ std::size_t Conversion::numberOfInstances(ConstArray source)
   throw Exception("Cannot parse an array of class " + std::string(mxGetClassName(source)) + " as ROS message");
 }
 
+const DecoderConstPtr& Conversion::encoder()
+{
+  if (!encoder_checked_) {
+    encoder_ = Decoder::forMessage(message_);
+    encoder_checked_ = true;
+  }
+  return encoder_;
+}
+
 MessagePtr Conversion::fromMatlab(ConstArray source, std::size_t index)
 {
+  // encode structs in bulk and deserialize the result, which is a memcpy for primitive arrays
+  DecoderConstPtr encoder = mxIsStruct(source) ? this->encoder() : DecoderConstPtr();
+  if (encoder) canDecode();
+  if (encoder && converter_ && !plan_->transforms) {
+    VoidPtr instance = message_->createInstance();
+    if (converter_->fromMatlab(source, index, *encoder, instance.get())) return message_->introspect(instance);
+  }
+
+  buffer_.clear();
+  if (encoder && encoder->encode(source, index, buffer_)) {
+    ros::serialization::IStream stream(buffer_.data(), buffer_.size());
+    VoidPtr instance = message_->deserialize(stream);
+    if (instance) return message_->introspect(instance);
+  }
+
   MessagePtr target = message_->introspect(message_->createInstance());
   fromMatlab(target, source, index);
   return target;
 }
 
+// Serializes a struct directly into the buffer of a message for ros::TopicManager::publish(), without an
+// intermediate message instance. Returns false if the layout of source is not supported by the encoder.
+// Buffers are pooled (see SerializedBuffers), so that publishing messages of the same size does not allocate.
+bool Conversion::serialize(ConstArray source, std::size_t index, ros::SerializedMessage& m)
+{
+  if (!mxIsStruct(source) || !encoder()) return false;
+  return serialized_.encode(*encoder_, source, index, m);
+}
+
+// serializes all columns of a double matrix in the flat layout of toDoubleMatrix() into a single block,
+// false if the message has variable-length fields or the matrix does not match that layout (see Decoder::getFlatColumns())
+bool Conversion::serializeColumns(ConstArray source, std::vector<ros::SerializedMessage>& messages)
+{
+  if (!mxIsDouble(source) || mxIsComplex(source) || !encoder()) return false;
+  if (encoder_->needsFlatVerification()) {
+    MessagePtr instance = message_->introspect(message_->createInstance());
+    encoder_->verifyFlatLayout(expand(instance)->size());
+  }
+  std::size_t columns = encoder_->getFlatColumns(source);
+  if (columns == 0) return false;
+
+  std::size_t stride = sizeof(uint32_t) + encoder_->getEncodedLength(0, 0);
+  boost::shared_array<uint8_t> block(new uint8_t[columns * stride]);
+  encoder_->unflatten(mxGetPr(source), columns, block.get() + sizeof(uint32_t), stride);
+
+  // the messages share the block, which is released with the last of them
+  uint32_t length = stride - sizeof(uint32_t);
+  messages.resize(columns);
+  for(std::size_t j = 0; j < columns; ++j) {
+    uint8_t *data = block.get() + j * stride;
+    std::memcpy(data, &length, sizeof(length));
+    messages[j].buf = boost::shared_array<uint8_t>(block, data);
+    messages[j].num_bytes = stride;
+    messages[j].message_start = data + sizeof(uint32_t);
+  }
+  return true;
+}
+
 void Conversion::fromMatlab(const MessagePtr& target, ConstArray source, std::size_t index)
 {
   if (mxIsStruct(source)) {
@@ -352,6 +655,34 @@ Array Conversion::convertToMatlab(const FieldPtr& field) {
       return target;
     }
 
+    // create a numeric array of the native type
+    Decoder::FieldType type;
+    if (settings_.numeric == ConversionOptions::NUMERIC_NATIVE && Decoder::getFieldType(field->getValueType(), type) && Decoder::getClassID(type) != mxDOUBLE_CLASS) {
+      if (type == Decoder::BOOL) {
+        target = mxCreateLogicalMatrix(1, field->size());
+        mxLogical *x = mxGetLogicals(target);
+        for(std::size_t i = 0; i < field->size(); i++) {
+          x[i] = (boost::any_cast<uint8_t>(field->get(i)) != 0);
+        }
+        return target;
+      }
+
+      target = mxCreateNumericMatrix(1, field->size(), Decoder::getClassID(type), mxREAL);
+      switch(type) {
+        case Decoder::INT8:    fillNative<int8_t>(field, mxGetData(target)); break;
+        case Decoder::UINT8:   fillNative<uint8_t>(field, mxGetData(target)); break;
+        case Decoder::INT16:   fillNative<int16_t>(field, mxGetData(target)); break;
+        case Decoder::UINT16:  fillNative<uint16_t>(field, mxGetData(target)); break;
+        case Decoder::INT32:   fillNative<int32_t>(field, mxGetData(target)); break;
+        case Decoder::UINT32:  fillNative<uint32_t>(field, mxGetData(target)); break;
+        case Decoder::INT64:   fillNative<int64_t>(field, mxGetData(target)); break;
+        case Decoder::UINT64:  fillNative<uint64_t>(field, mxGetData(target)); break;
+        case Decoder::FLOAT32: fillNative<float>(field, mxGetData(target)); break;
+        default: break;
+      }
+      return target;
+    }
+
 //    ROSMATLAB_PRINTF("Constructing double vector with dimension %u for field %s", unsigned(field->size()), field->getName());
     target = mxCreateDoubleMatrix(1, field->size(), mxREAL);
     double *x = mxGetPr(target);
@@ -420,8 +751,15 @@ void Conversion::convertFromMatlab(const FieldPtr &field, ConstArray source) {
     return;
   }
 
-  // For all other types source must be a double array...
-  if (!mxIsDouble(source)) throw Exception("Failed to parse field " + std::string(field->getDataType()) + " " + std::string(field->getName()) + ": Array must be a double array");
+  // For all other types source must be a numeric array...
+  if (!mxIsDouble(source)) {
+    if (!mxIsNumeric(source) && !mxIsLogical(source)) throw Exception("Failed to parse field " + std::string(field->getDataType()) + " " + std::string(field->getName()) + ": Array must be a numeric array");
+    std::vector<double> x(mxGetNumberOfElements(source));
+    for(std::size_t i = 0; i < x.size(); i++) x[i] = getDouble(source, i);
+    convertFromDouble(field, x.data(), x.data() + x.size());
+    return;
+  }
+
   const double *x = mxGetPr(source);
   convertFromDouble(field, x, x + mxGetN(source));
 }
@@ -470,6 +808,19 @@ const MessagePtr& Conversion::expanded() {
   return expanded_;
 }
 
+Conversion &Conversion::setMessage(const MessagePtr &message) {
+  if (!message || !message_ || std::strcmp(message->getDataType(), message_->getDataType()) != 0) {
+    decoder_.reset();
+    plan_.reset();
+    decoder_checked_ = false;
+    flattener_.reset();
+    flattener_checked_ = false;
+  }
+  message_ = message;
+  expanded_.reset();
+  return *this;
+}
+
 ConversionOptions &Conversion::defaultOptions() {
   static boost::shared_ptr<ConversionOptions> default_options;
   if (!default_options) {
@@ -508,6 +859,8 @@ void ConversionOptions::init(int nrhs, const mxArray *prhs[])
       setConversionType(MATLAB_MATRIX);
     else if (boost::algorithm::iequals(type, "extended"))
       setConversionType(MATLAB_EXTENDED_STRUCT);
+    else if (boost::algorithm::iequals(type, "columnar"))
+      setConversionType(MATLAB_COLUMNAR);
     else
       throw Exception("unknown conversion type '" + type + "'");
   }
@@ -515,6 +868,40 @@ void ConversionOptions::init(int nrhs, const mxArray *prhs[])
   if (conversionType() >= MATLAB_TYPE_MAX) {
     throw Exception("illegal conversion type " + boost::lexical_cast<std::string>(conversionType()));
   }
+
+  std::string numeric = getString("numeric");
+  if (!numeric.empty()) {
+    if (boost::algorithm::iequals(numeric, "double"))
+      setNumericType(NUMERIC_DOUBLE);
+    else if (boost::algorithm::iequals(numeric, "native"))
+      setNumericType(NUMERIC_NATIVE);
+    else
+      throw Exception("unknown numeric type '" + numeric + "'");
+  }
+
+  std::string strings = getString("strings");
+  if (!strings.empty()) {
+    if (boost::algorithm::iequals(strings, "char"))
+      setStringType(STRINGS_CHAR);
+    else if (boost::algorithm::iequals(strings, "dictionary"))
+      setStringType(STRINGS_DICTIONARY);
+    else if (boost::algorithm::iequals(strings, "categorical"))
+      setStringType(STRINGS_CATEGORICAL);
+    else
+      throw Exception("unknown string type '" + strings + "'");
+  }
+
+  std::string pointcloud = getString("pointcloud");
+  if (!pointcloud.empty()) {
+    if (boost::algorithm::iequals(pointcloud, "raw"))
+      setPointCloudType(POINTCLOUD_RAW);
+    else if (boost::algorithm::iequals(pointcloud, "matrix"))
+      setPointCloudType(POINTCLOUD_MATRIX);
+    else if (boost::algorithm::iequals(pointcloud, "fields"))
+      setPointCloudType(POINTCLOUD_FIELDS);
+    else
+      throw Exception("unknown point cloud type '" + pointcloud + "'");
+  }
 }
 
 ConversionOptions::MatlabType ConversionOptions::conversionType() const
@@ -528,6 +915,8 @@ std::string ConversionOptions::conversionTypeString() const
     case MATLAB_STRUCT: return "struct";
     case MATLAB_MATRIX: return "matrix";
     case MATLAB_EXTENDED_STRUCT: return "extended";
+    case MATLAB_COLUMNAR: return "columnar";
+    default: break;
   }
   return std::string();
 }
@@ -538,6 +927,65 @@ ConversionOptions &ConversionOptions::setConversionType(ConversionOptions::Matla
   return *this;
 }
 
+ConversionOptions::NumericType ConversionOptions::numericType() const
+{
+  return static_cast<ConversionOptions::NumericType>(getInteger("numeric"));
+}
+
+std::string ConversionOptions::numericTypeString() const
+{
+  switch(numericType()) {
+    case NUMERIC_DOUBLE: return "double";
+    case NUMERIC_NATIVE: return "native";
+    default: break;
+  }
+  return std::string();
+}
+
+ConversionOptions &ConversionOptions::setNumericType(ConversionOptions::NumericType type)
+{
+  set("numeric", static_cast<int>(type));
+  return *this;
+}
+
+ConversionOptions::StringType ConversionOptions::stringType() const
+{
+  return static_cast<ConversionOptions::StringType>(getInteger("strings"));
+}
+
+std::string ConversionOptions::stringTypeString() const
+{
+  switch(stringType()) {
+    case STRINGS_CHAR: return "char";
+    case STRINGS_DICTIONARY: return "dictionary";
+    case STRINGS_CATEGORICAL: return "categorical";
+    default: break;
+  }
+  return std::string();
+}
+
+ConversionOptions &ConversionOptions::setStringType(ConversionOptions::StringType type)
+{
+  set("strings", static_cast<int>(type));
+  return *this;
+}
+
+ConversionOptions::Snapshot ConversionOptions::snapshot() const
+{
+  Snapshot snapshot;
+  snapshot.type = conversionType();
+  snapshot.numeric = numericType();
+  // only columnar and extended conversions encode strings
+  snapshot.strings = (snapshot.type == MATLAB_COLUMNAR || snapshot.type == MATLAB_EXTENDED_STRUCT) ? stringType() : STRINGS_CHAR;
+  snapshot.add_meta_data = addMetaData();
+  snapshot.add_connection_header = addConnectionHeader();
+  snapshot.reshape = reshapeArrays();
+  snapshot.pointcloud = pointCloudType();
+  snapshot.remove_nan = removeNaN();
+  snapshot.decompress = decompressImages();
+  return snapshot;
+}
+
 bool ConversionOptions::addMetaData() const
 {
   return getBool("meta");
@@ -560,12 +1008,73 @@ ConversionOptions &ConversionOptions::setAddConnectionHeader(bool value)
   return *this;
 }
 
+bool ConversionOptions::reshapeArrays() const
+{
+  return getBool("reshape");
+}
+
+ConversionOptions &ConversionOptions::setReshapeArrays(bool value)
+{
+  set("reshape", value);
+  return *this;
+}
+
+ConversionOptions::PointCloudType ConversionOptions::pointCloudType() const
+{
+  return static_cast<ConversionOptions::PointCloudType>(getInteger("pointcloud"));
+}
+
+std::string ConversionOptions::pointCloudTypeString() const
+{
+  switch(pointCloudType()) {
+    case POINTCLOUD_RAW: return "raw";
+    case POINTCLOUD_MATRIX: return "matrix";
+    case POINTCLOUD_FIELDS: return "fields";
+    default: break;
+  }
+  return std::string();
+}
+
+ConversionOptions &ConversionOptions::setPointCloudType(ConversionOptions::PointCloudType type)
+{
+  set("pointcloud", static_cast<int>(type));
+  return *this;
+}
+
+bool ConversionOptions::removeNaN() const
+{
+  return getBool("removenan");
+}
+
+ConversionOptions &ConversionOptions::setRemoveNaN(bool value)
+{
+  set("removenan", value);
+  return *this;
+}
+
+bool ConversionOptions::decompressImages() const
+{
+  return getBool("decompress");
+}
+
+ConversionOptions &ConversionOptions::setDecompressImages(bool value)
+{
+  set("decompress", value);
+  return *this;
+}
+
 mxArray *ConversionOptions::toMatlab() const {
-  const char *fieldnames[] = { "Type", "Meta", "ConnectionHeader" };
+  const char *fieldnames[] = { "Type", "Numeric", "Strings", "Meta", "ConnectionHeader", "Reshape", "PointCloud", "RemoveNaN", "Decompress" };
   mxArray *result = mxCreateStructMatrix(1, 1, sizeof(fieldnames)/sizeof(*fieldnames), fieldnames);
   mxSetField(result, 0, "Type", mxCreateString(conversionTypeString().c_str()));
+  mxSetField(result, 0, "Numeric", mxCreateString(numericTypeString().c_str()));
+  mxSetField(result, 0, "Strings", mxCreateString(stringTypeString().c_str()));
   mxSetField(result, 0, "Meta", mxCreateLogicalScalar(addMetaData()));
   mxSetField(result, 0, "ConnectionHeader", mxCreateLogicalScalar(addConnectionHeader()));
+  mxSetField(result, 0, "Reshape", mxCreateLogicalScalar(reshapeArrays()));
+  mxSetField(result, 0, "PointCloud", mxCreateString(pointCloudTypeString().c_str()));
+  mxSetField(result, 0, "RemoveNaN", mxCreateLogicalScalar(removeNaN()));
+  mxSetField(result, 0, "Decompress", mxCreateLogicalScalar(decompressImages()));
   return result;
 }
 
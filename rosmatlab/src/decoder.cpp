@@ -0,0 +1,1748 @@
+//=================================================================================================
+// Copyright (c) 2013, Johannes Meyer, TU Darmstadt
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of the Flight Systems and Automatic Control group,
+//       TU Darmstadt, nor the names of its contributors may be used to
+//       endorse or promote products derived from this software without
+//       specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//=================================================================================================
+
+#include <rosmatlab/decoder.h>
+#include <rosmatlab/conversion.h>
+#include <rosmatlab/exception.h>
+#include <rosmatlab/transpose.h>
+#include <rosmatlab/compressed_image.h>
+#include <rosmatlab/saturate.h>
+
+#include <introspection/message.h>
+
+#include <ros/time.h>
+#include <ros/duration.h>
+#include <ros/console.h>
+
+#include <boost/algorithm/string.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/bind.hpp>
+
+#include <sstream>
+#include <cstring>
+#include <cctype>
+#include <algorithm>
+#include <limits>
+#include <cmath>
+
+#include <mex.h>
+
+#if defined(__SSE2__) || defined(_M_X64)
+  #define ROSMATLAB_HAVE_SSE2
+  #include <emmintrin.h>
+#endif
+
+namespace rosmatlab {
+
+unsigned int Decoder::generation_ = 0;
+
+namespace {
+  template <typename T> static inline T read(ros::serialization::IStream& stream) {
+    T value;
+    std::memcpy(&value, stream.advance(sizeof(T)), sizeof(T));
+    return value;
+  }
+
+  template <typename T> static inline void convertToDouble(const uint8_t *data, double *x, std::size_t count) {
+    for(std::size_t i = 0; i < count; ++i, data += sizeof(T)) {
+      T value;
+      std::memcpy(&value, data, sizeof(T));
+      x[i] = static_cast<double>(value);
+    }
+  }
+
+#ifdef ROSMATLAB_HAVE_SSE2
+  // SSE2 widening conversions, the remainder is converted by the generic version
+  static inline void store4(double *x, __m128i value) {
+    _mm_storeu_pd(x,     _mm_cvtepi32_pd(value));
+    _mm_storeu_pd(x + 2, _mm_cvtepi32_pd(_mm_shuffle_epi32(value, _MM_SHUFFLE(1, 0, 3, 2))));
+  }
+
+  template <> inline void convertToDouble<uint8_t>(const uint8_t *data, double *x, std::size_t count) {
+    const __m128i zero = _mm_setzero_si128();
+    std::size_t i = 0;
+    for(; i + 16 <= count; i += 16) {
+      __m128i v  = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i));
+      __m128i lo = _mm_unpacklo_epi8(v, zero);
+      __m128i hi = _mm_unpackhi_epi8(v, zero);
+      store4(x + i,      _mm_unpacklo_epi16(lo, zero));
+      store4(x + i + 4,  _mm_unpackhi_epi16(lo, zero));
+      store4(x + i + 8,  _mm_unpacklo_epi16(hi, zero));
+      store4(x + i + 12, _mm_unpackhi_epi16(hi, zero));
+    }
+    for(; i < count; ++i) x[i] = data[i];
+  }
+
+  template <> inline void convertToDouble<int8_t>(const uint8_t *data, double *x, std::size_t count) {
+    std::size_t i = 0;
+    for(; i + 16 <= count; i += 16) {
+      __m128i v  = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i));
+      __m128i lo = _mm_srai_epi16(_mm_unpacklo_epi8(v, v), 8);
+      __m128i hi = _mm_srai_epi16(_mm_unpackhi_epi8(v, v), 8);
+      store4(x + i,      _mm_srai_epi32(_mm_unpacklo_epi16(lo, lo), 16));
+      store4(x + i + 4,  _mm_srai_epi32(_mm_unpackhi_epi16(lo, lo), 16));
+      store4(x + i + 8,  _mm_srai_epi32(_mm_unpacklo_epi16(hi, hi), 16));
+      store4(x + i + 12, _mm_srai_epi32(_mm_unpackhi_epi16(hi, hi), 16));
+    }
+    for(; i < count; ++i) x[i] = static_cast<int8_t>(data[i]);
+  }
+
+  template <> inline void convertToDouble<uint16_t>(const uint8_t *data, double *x, std::size_t count) {
+    const __m128i zero = _mm_setzero_si128();
+    std::size_t i = 0;
+    for(; i + 8 <= count; i += 8) {
+      __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i * sizeof(uint16_t)));
+      store4(x + i,     _mm_unpacklo_epi16(v, zero));
+      store4(x + i + 4, _mm_unpackhi_epi16(v, zero));
+    }
+    for(; i < count; ++i) { uint16_t value; std::memcpy(&value, data + i * sizeof(uint16_t), sizeof(value)); x[i] = value; }
+  }
+
+  template <> inline void convertToDouble<int16_t>(const uint8_t *data, double *x, std::size_t count) {
+    std::size_t i = 0;
+    for(; i + 8 <= count; i += 8) {
+      __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i * sizeof(int16_t)));
+      store4(x + i,     _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16));
+      store4(x + i + 4, _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16));
+    }
+    for(; i < count; ++i) { int16_t value; std::memcpy(&value, data + i * sizeof(int16_t), sizeof(value)); x[i] = value; }
+  }
+
+  template <> inline void convertToDouble<int32_t>(const uint8_t *data, double *x, std::size_t count) {
+    std::size_t i = 0;
+    for(; i + 4 <= count; i += 4) {
+      store4(x + i, _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i * sizeof(int32_t))));
+    }
+    for(; i < count; ++i) { int32_t value; std::memcpy(&value, data + i * sizeof(int32_t), sizeof(value)); x[i] = value; }
+  }
+
+  template <> inline void convertToDouble<float>(const uint8_t *data, double *x, std::size_t count) {
+    std::size_t i = 0;
+    for(; i + 4 <= count; i += 4) {
+      __m128 v = _mm_loadu_ps(reinterpret_cast<const float *>(data + i * sizeof(float)));
+      _mm_storeu_pd(x + i,     _mm_cvtps_pd(v));
+      _mm_storeu_pd(x + i + 2, _mm_cvtps_pd(_mm_movehl_ps(v, v)));
+    }
+    for(; i < count; ++i) { float value; std::memcpy(&value, data + i * sizeof(float), sizeof(value)); x[i] = value; }
+  }
+#endif
+
+  template <typename T> static inline void convertTimes(const uint8_t *data, double *x, std::size_t count) {
+    for(std::size_t i = 0; i < count; ++i, data += 2 * sizeof(T)) {
+      T sec, nsec;
+      std::memcpy(&sec, data, sizeof(T));
+      std::memcpy(&nsec, data + sizeof(T), sizeof(T));
+      x[i] = static_cast<double>(sec) + 1e-9 * static_cast<double>(nsec);
+    }
+  }
+
+  static void convertToDouble(const uint8_t *data, Decoder::FieldType type, double *x, std::size_t count) {
+    switch(type) {
+      case Decoder::BOOL:     convertToDouble<uint8_t>(data, x, count); break;
+      case Decoder::INT8:     convertToDouble<int8_t>(data, x, count); break;
+      case Decoder::UINT8:    convertToDouble<uint8_t>(data, x, count); break;
+      case Decoder::INT16:    convertToDouble<int16_t>(data, x, count); break;
+      case Decoder::UINT16:   convertToDouble<uint16_t>(data, x, count); break;
+      case Decoder::INT32:    convertToDouble<int32_t>(data, x, count); break;
+      case Decoder::UINT32:   convertToDouble<uint32_t>(data, x, count); break;
+      case Decoder::INT64:    convertToDouble<int64_t>(data, x, count); break;
+      case Decoder::UINT64:   convertToDouble<uint64_t>(data, x, count); break;
+      case Decoder::FLOAT32:  convertToDouble<float>(data, x, count); break;
+      case Decoder::FLOAT64:  convertToDouble<double>(data, x, count); break;
+      case Decoder::TIME:     convertTimes<uint32_t>(data, x, count); break;
+      case Decoder::DURATION: convertTimes<int32_t>(data, x, count); break;
+      default: break;
+    }
+  }
+
+  static inline void convertToLogical(const uint8_t *data, mxLogical *x, std::size_t count) {
+    for(std::size_t i = 0; i < count; ++i) x[i] = (data[i] != 0);
+  }
+
+  static inline void readDoubles(ros::serialization::IStream& stream, Decoder::FieldType type, double *x, std::size_t count) {
+    const uint8_t *data = stream.advance(count * Decoder::getSize(type));
+    convertToDouble(data, type, x, count);
+  }
+
+  static inline std::string readString(ros::serialization::IStream& stream) {
+    uint32_t length = read<uint32_t>(stream);
+    const uint8_t *data = stream.advance(length);
+    return std::string(reinterpret_cast<const char *>(data), length);
+  }
+
+  static inline uint8_t *grow(std::vector<uint8_t>& buffer, std::size_t length) {
+    std::size_t offset = buffer.size();
+    buffer.resize(offset + length);
+    return buffer.data() + offset;
+  }
+
+  template <typename T> static inline void write(std::vector<uint8_t>& buffer, const T& value) {
+    std::memcpy(grow(buffer, sizeof(T)), &value, sizeof(T));
+  }
+
+  // writes a length-prefixed string like Options::getString(), but without a temporary copy
+  static inline void writeString(std::vector<uint8_t>& buffer, const mxArray *source) {
+    std::size_t offset = buffer.size();
+    std::size_t length = mxGetNumberOfElements(source);
+    char *data = reinterpret_cast<char *>(grow(buffer, sizeof(uint32_t) + length + 1) + sizeof(uint32_t));
+    mxGetString(source, data, length + 1);
+    uint32_t size = std::strlen(data);
+    std::memcpy(buffer.data() + offset, &size, sizeof(size));
+    buffer.resize(offset + sizeof(uint32_t) + size);
+  }
+
+  template <typename From, typename To> static inline void castArray(const void *source, uint8_t *data, std::size_t count) {
+    const From *x = static_cast<const From *>(source);
+    for(std::size_t i = 0; i < count; ++i, data += sizeof(To)) {
+      To value = Saturate<To, From>::apply(x[i]);
+      std::memcpy(data, &value, sizeof(To));
+    }
+  }
+
+  template <typename To> static void writeNumeric(const void *x, mxClassID class_id, uint8_t *data, std::size_t count) {
+    switch(class_id) {
+      case mxDOUBLE_CLASS:  castArray<double, To>(x, data, count); break;
+      case mxSINGLE_CLASS:  castArray<float, To>(x, data, count); break;
+      case mxLOGICAL_CLASS: castArray<mxLogical, To>(x, data, count); break;
+      case mxINT8_CLASS:    castArray<int8_t, To>(x, data, count); break;
+      case mxUINT8_CLASS:   castArray<uint8_t, To>(x, data, count); break;
+      case mxINT16_CLASS:   castArray<int16_t, To>(x, data, count); break;
+      case mxUINT16_CLASS:  castArray<uint16_t, To>(x, data, count); break;
+      case mxINT32_CLASS:   castArray<int32_t, To>(x, data, count); break;
+      case mxUINT32_CLASS:  castArray<uint32_t, To>(x, data, count); break;
+      case mxINT64_CLASS:   castArray<int64_t, To>(x, data, count); break;
+      case mxUINT64_CLASS:  castArray<uint64_t, To>(x, data, count); break;
+      default: throw Exception("Arrays of class " + boost::lexical_cast<std::string>(class_id) + " cannot be converted to numbers");
+    }
+  }
+
+  template <typename To> static void writeNumeric(const mxArray *source, uint8_t *data, std::size_t count) {
+    writeNumeric<To>(mxGetData(source), mxGetClassID(source), data, count);
+  }
+
+  template <typename Time> static void writeTimes(const double *x, uint8_t *data, std::size_t count) {
+    for(std::size_t i = 0; i < count; ++i, data += 8) {
+      Time time(x[i]);
+      std::memcpy(data, &time.sec, 4);
+      std::memcpy(data + 4, &time.nsec, 4);
+    }
+  }
+
+  // converted to double in chunks on the stack, so that encoding does not allocate
+  template <typename Time> static void writeTimes(const mxArray *source, uint8_t *data, std::size_t count) {
+    static const std::size_t CHUNK = 64;
+    double x[CHUNK];
+    const uint8_t *values = static_cast<const uint8_t *>(mxGetData(source));
+    std::size_t element_size = mxGetElementSize(source);
+    for(std::size_t offset = 0; offset < count; offset += CHUNK) {
+      std::size_t n = std::min(CHUNK, count - offset);
+      writeNumeric<double>(values + offset * element_size, mxGetClassID(source), reinterpret_cast<uint8_t *>(x), n);
+      writeTimes<Time>(x, data + offset * 8, n);
+    }
+  }
+
+  // worker of Decoder::unflatten(), serializes chunks of columns until all have been taken
+  static void unflattenColumns(const Decoder *decoder, const double *x, std::size_t rows, std::size_t columns, uint8_t *data, std::size_t stride,
+                               std::size_t chunk, boost::atomic<std::size_t> *next, boost::atomic<bool> *failed) {
+    try {
+      for(std::size_t begin = next->fetch_add(chunk); begin < columns && !*failed; begin = next->fetch_add(chunk)) {
+        std::size_t end = std::min(begin + chunk, columns);
+        for(std::size_t j = begin; j < end; ++j) {
+          uint8_t *column = data + j * stride;
+          decoder->unflatten(x + j * rows, column);
+        }
+      }
+    } catch(std::exception&) {
+      *failed = true;
+    }
+  }
+
+  // split a full message definition into the definitions of the individual message types
+  static void splitDefinitions(const std::string& datatype, const std::string& definition, std::map<std::string, std::string>& definitions) {
+    std::istringstream stream(definition);
+    std::string current = datatype;
+    std::string line;
+
+    while(std::getline(stream, line)) {
+      if (boost::algorithm::starts_with(line, "==========")) continue;
+      if (boost::algorithm::starts_with(line, "MSG: ")) {
+        current = boost::algorithm::trim_copy(line.substr(5));
+        continue;
+      }
+      definitions[current] += line + "\n";
+    }
+  }
+
+  static inline double getScalarField(const mxArray *source, std::size_t index, const char *name) {
+    const mxArray *field = source ? mxGetField(source, index, name) : 0;
+    if (!field || mxIsEmpty(field) || !(mxIsNumeric(field) || mxIsLogical(field))) return 0.0;
+    return mxGetScalar(field);
+  }
+
+  static bool isShapedArray(const mxArray *source) {
+    if (!mxIsNumeric(source) && !mxIsLogical(source)) return false;
+    return mxGetNumberOfDimensions(source) > 2 || (mxGetM(source) > 1 && mxGetN(source) > 1);
+  }
+
+  // element type and number of channels of an image encoding (see sensor_msgs/image_encodings.h)
+  static bool parseEncoding(const std::string& encoding, Decoder::FieldType& type, std::size_t& channels) {
+    static const struct { const char *name; Decoder::FieldType type; std::size_t channels; } encodings[] = {
+      { "mono8",  Decoder::UINT8,  1 }, { "mono16", Decoder::UINT16, 1 },
+      { "rgb8",   Decoder::UINT8,  3 }, { "bgr8",   Decoder::UINT8,  3 },
+      { "rgba8",  Decoder::UINT8,  4 }, { "bgra8",  Decoder::UINT8,  4 },
+      { "rgb16",  Decoder::UINT16, 3 }, { "bgr16",  Decoder::UINT16, 3 },
+      { "rgba16", Decoder::UINT16, 4 }, { "bgra16", Decoder::UINT16, 4 }
+    };
+    for(std::size_t i = 0; i < sizeof(encodings)/sizeof(*encodings); ++i) {
+      if (encoding != encodings[i].name) continue;
+      type = encodings[i].type;
+      channels = encodings[i].channels;
+      return true;
+    }
+
+    if (boost::algorithm::starts_with(encoding, "bayer_")) {
+      channels = 1;
+      if (boost::algorithm::ends_with(encoding, "16")) { type = Decoder::UINT16; return true; }
+      if (boost::algorithm::ends_with(encoding, "8"))  { type = Decoder::UINT8; return true; }
+      return false;
+    }
+
+    // OpenCV style encodings like 8UC3 or 32FC1
+    std::size_t c = encoding.find('C');
+    if (c < 2 || c + 1 >= encoding.size()) return false;
+    std::string depth = encoding.substr(0, c);
+    if      (depth == "8U")  type = Decoder::UINT8;
+    else if (depth == "8S")  type = Decoder::INT8;
+    else if (depth == "16U") type = Decoder::UINT16;
+    else if (depth == "16S") type = Decoder::INT16;
+    else if (depth == "32S") type = Decoder::INT32;
+    else if (depth == "32F") type = Decoder::FLOAT32;
+    else if (depth == "64F") type = Decoder::FLOAT64;
+    else return false;
+
+    try {
+      channels = boost::lexical_cast<std::size_t>(encoding.substr(c + 1));
+    } catch(boost::bad_lexical_cast&) {
+      return false;
+    }
+    return channels > 0;
+  }
+
+  // offsets of all slices spanned by the dimensions between the first and the last one
+  static void getSliceOffsets(const std::vector<std::size_t>& sizes, const std::vector<std::size_t>& a_strides, const std::vector<std::size_t>& b_strides,
+                              std::vector<std::size_t>& a, std::vector<std::size_t>& b) {
+    a.assign(1, 0);
+    b.assign(1, 0);
+    for(std::size_t j = 1; j + 1 < sizes.size(); ++j) {
+      std::size_t n = a.size();
+      for(std::size_t i = 1; i < sizes[j]; ++i) {
+        for(std::size_t m = 0; m < n; ++m) {
+          a.push_back(a[m] + i * a_strides[j]);
+          b.push_back(b[m] + i * b_strides[j]);
+        }
+      }
+    }
+  }
+
+  // a sensor_msgs/PointField and its element type
+  struct PointField {
+    std::string name;
+    Decoder::FieldType type;
+    std::size_t offset;
+    std::size_t count;
+  };
+
+  static bool getPointFieldType(double datatype, Decoder::FieldType& type) {
+    static const Decoder::FieldType types[] = { Decoder::INT8, Decoder::UINT8, Decoder::INT16, Decoder::UINT16, Decoder::INT32, Decoder::UINT32, Decoder::FLOAT32, Decoder::FLOAT64 };
+    if (!(datatype >= 1.0 && datatype <= 8.0)) return false;
+    type = types[static_cast<std::size_t>(datatype) - 1];
+    return true;
+  }
+
+  // a valid Matlab field name for the name of a point field
+  static std::string getPointFieldName(const std::string& name) {
+    std::string result;
+    for(std::string::const_iterator c = name.begin(); c != name.end(); ++c) {
+      result += std::isalnum(static_cast<unsigned char>(*c)) ? *c : '_';
+    }
+    if (result.empty() || !std::isalpha(static_cast<unsigned char>(result[0]))) result = "f" + result;
+    return result.substr(0, mxMAXNAM - 1);
+  }
+
+  static inline bool isNaN(const uint8_t *data, Decoder::FieldType type) {
+    if (type == Decoder::FLOAT32) { float value; std::memcpy(&value, data, sizeof(value)); return value != value; }
+    if (type == Decoder::FLOAT64) { double value; std::memcpy(&value, data, sizeof(value)); return value != value; }
+    return false;
+  }
+
+  // copies count consecutive values of the same type of every point into count columns of a column-major
+  // (height*width)xK array, or into count HxW planes of a HxWxK array if organized
+  static void gatherPointField(uint8_t *target, std::size_t target_size, bool to_double, const uint8_t *data, Decoder::FieldType type, std::size_t count,
+                               std::size_t height, std::size_t width, std::size_t point_step, std::size_t row_step, bool organized) {
+    std::size_t element_size = Decoder::getSize(type);
+    std::size_t column_stride = height * width * target_size;
+    to_double = to_double && type != Decoder::FLOAT64;
+
+    for(std::size_t i = 0; i < (organized ? count : height); ++i) {
+      if (organized) {
+        uint8_t *plane = target + i * column_stride;
+        const uint8_t *source = data + i * element_size;
+        if (to_double) {
+          transposeToDouble(plane, target_size, height * target_size, source, row_step, point_step, height, width, type);
+        } else {
+          transpose(plane, target_size, height * target_size, source, row_step, point_step, height, width, element_size);
+        }
+      } else {
+        // all points of a row, so that the values of a point are transposed in tiles
+        uint8_t *rows = target + i * width * target_size;
+        const uint8_t *source = data + i * row_step;
+        if (to_double) {
+          transposeToDouble(rows, target_size, column_stride, source, point_step, element_size, width, count, type);
+        } else {
+          transpose(rows, target_size, column_stride, source, point_step, element_size, width, count, element_size);
+        }
+      }
+    }
+  }
+
+  // moves the given rows of a column-major rows x columns array to the front, so that it becomes a keep.size() x columns array
+  static void compactRows(uint8_t *data, std::size_t rows, std::size_t columns, const std::vector<std::size_t>& keep, std::size_t element_size) {
+    for(std::size_t c = 0; c < columns; ++c) {
+      const uint8_t *source = data + c * rows * element_size;
+      uint8_t *target = data + c * keep.size() * element_size;
+      for(std::size_t r = 0; r < keep.size(); ++r) {
+        std::memmove(target + r * element_size, source + keep[r] * element_size, element_size);
+      }
+    }
+  }
+}
+
+bool Decoder::getFieldType(const std::string& type, FieldType& result)
+{
+  static std::map<std::string, FieldType> types;
+  if (types.empty()) {
+    types["bool"]     = BOOL;
+    types["byte"]     = INT8;
+    types["char"]     = UINT8;
+    types["int8"]     = INT8;
+    types["uint8"]    = UINT8;
+    types["int16"]    = INT16;
+    types["uint16"]   = UINT16;
+    types["int32"]    = INT32;
+    types["uint32"]   = UINT32;
+    types["int64"]    = INT64;
+    types["uint64"]   = UINT64;
+    types["float32"]  = FLOAT32;
+    types["float64"]  = FLOAT64;
+    types["string"]   = STRING;
+    types["time"]     = TIME;
+    types["duration"] = DURATION;
+  }
+
+  std::map<std::string, FieldType>::const_iterator it = types.find(type);
+  if (it == types.end()) return false;
+  result = it->second;
+  return true;
+}
+
+mxClassID Decoder::getClassID(FieldType type, bool native)
+{
+  if (!native) return mxDOUBLE_CLASS;
+
+  switch(type) {
+    case BOOL:    return mxLOGICAL_CLASS;
+    case INT8:    return mxINT8_CLASS;
+    case UINT8:   return mxUINT8_CLASS;
+    case INT16:   return mxINT16_CLASS;
+    case UINT16:  return mxUINT16_CLASS;
+    case INT32:   return mxINT32_CLASS;
+    case UINT32:  return mxUINT32_CLASS;
+    case INT64:   return mxINT64_CLASS;
+    case UINT64:  return mxUINT64_CLASS;
+    case FLOAT32: return mxSINGLE_CLASS;
+    case STRING:  return mxCHAR_CLASS;
+    case MESSAGE: return mxSTRUCT_CLASS;
+    default:      return mxDOUBLE_CLASS;
+  }
+}
+
+std::size_t Decoder::getSize(FieldType type)
+{
+  switch(type) {
+    case BOOL:     return 1;
+    case INT8:     return 1;
+    case UINT8:    return 1;
+    case INT16:    return 2;
+    case UINT16:   return 2;
+    case INT32:    return 4;
+    case UINT32:   return 4;
+    case INT64:    return 8;
+    case UINT64:   return 8;
+    case FLOAT32:  return 4;
+    case FLOAT64:  return 8;
+    case TIME:     return 8;
+    case DURATION: return 8;
+    default:       return 0;
+  }
+}
+
+Decoder::Decoder(const std::string& datatype)
+  : datatype_(datatype)
+  , introspection_(cpp_introspection::messageByDataType(datatype))
+  , flat_(false)
+  , flat_size_(0)
+  , flat_verified_(0)
+  , payload_(false)
+  , fixed_length_(false)
+  , encoded_length_(0)
+  , shape_(SHAPE_NONE)
+  , shape_field_(0)
+  , plans_generation_(generation_)
+{
+}
+
+Decoder::~Decoder()
+{
+}
+
+DecoderConstPtr Decoder::forMessage(const MessagePtr& message)
+{
+  static std::map<std::string, DecoderConstPtr> decoders;
+  if (!message) return DecoderConstPtr();
+
+  std::string key = std::string(message->getDataType()) + "/" + message->getMD5Sum();
+  std::map<std::string, DecoderConstPtr>::const_iterator it = decoders.find(key);
+  if (it != decoders.end()) return it->second;
+
+  // parse the message definition (null if the definition cannot be parsed)
+  DecoderPtr decoder;
+  try {
+    decoder = parse(message->getDataType(), message->getDefinition());
+    if (!decoder->introspection_) decoder->introspection_ = message;
+  } catch(std::exception& e) {
+    decoder.reset();
+  }
+
+  decoders[key] = decoder;
+  return decoder;
+}
+
+DecoderConstPtr Decoder::forDefinition(const std::string& datatype, const std::string& definition)
+{
+  return parse(datatype, definition);
+}
+
+DecoderPtr Decoder::parse(const std::string& datatype, const std::string& definition)
+{
+  Definitions definitions;
+  Decoders parsed;
+  splitDefinitions(datatype, definition, definitions);
+  return parse(datatype, definitions, parsed);
+}
+
+DecoderPtr Decoder::parse(const std::string& datatype, const Definitions& definitions, Decoders& decoders)
+{
+  Decoders::const_iterator it = decoders.find(datatype);
+  if (it != decoders.end()) return it->second;
+
+  Definitions::const_iterator definition = definitions.find(datatype);
+  if (definition == definitions.end()) throw UnknownDataTypeException(datatype, "No definition found.");
+
+  DecoderPtr decoder(new Decoder(datatype));
+  decoders[datatype] = decoder;
+  std::string package = datatype.substr(0, datatype.find('/'));
+
+  std::istringstream stream(definition->second);
+  std::string line;
+  while(std::getline(stream, line)) {
+    // strip comments and skip constants
+    std::size_t comment = line.find('#');
+    if (comment != std::string::npos) line.erase(comment);
+    if (line.find('=') != std::string::npos) continue;
+
+    std::istringstream tokens(line);
+    std::string type;
+    Field field;
+    if (!(tokens >> type >> field.name)) continue;
+
+    // parse array specification
+    field.is_array = false;
+    field.array_length = 0;
+    std::size_t bracket = type.find('[');
+    if (bracket != std::string::npos) {
+      std::string length = type.substr(bracket + 1, type.find(']', bracket) - bracket - 1);
+      field.is_array = true;
+      if (!length.empty()) field.array_length = boost::lexical_cast<std::size_t>(length);
+      type.erase(bracket);
+    }
+
+    // resolve type
+    if (!getFieldType(type, field.type)) {
+      field.type = MESSAGE;
+      if (type == "Header") type = "std_msgs/Header";
+      if (type.find('/') == std::string::npos) type = package + "/" + type;
+      field.message = parse(type, definitions, decoders);
+    }
+
+    decoder->fields_.push_back(field);
+  }
+
+  for(Fields::const_iterator field = decoder->fields_.begin(); field != decoder->fields_.end(); ++field) {
+    decoder->field_names_.push_back(field->name.c_str());
+  }
+
+  // images, MultiArrays and point clouds can be reshaped if they have the expected fields
+  std::size_t data = decoder->getFieldIndex("data");
+  if (data < decoder->fields_.size() && decoder->fields_[data].is_array && decoder->fields_[data].array_length == 0 &&
+      decoder->fields_[data].type != STRING && decoder->fields_[data].type != MESSAGE) {
+    const char *image_fields[] = { "height", "width", "encoding", "is_bigendian", "step" };
+    bool image = (datatype == "sensor_msgs/Image");
+    for(std::size_t i = 0; image && i < sizeof(image_fields)/sizeof(*image_fields); ++i) {
+      image = decoder->getFieldIndex(image_fields[i]) < data;
+    }
+    bool multiarray = boost::algorithm::starts_with(datatype, "std_msgs/") && boost::algorithm::ends_with(datatype, "MultiArray") &&
+                      decoder->getFieldIndex("layout") < data;
+
+    const char *pointcloud_fields[] = { "height", "width", "fields", "is_bigendian", "point_step", "row_step" };
+    bool pointcloud = (datatype == "sensor_msgs/PointCloud2") && decoder->fields_[data].type == UINT8;
+    for(std::size_t i = 0; pointcloud && i < sizeof(pointcloud_fields)/sizeof(*pointcloud_fields); ++i) {
+      pointcloud = decoder->getFieldIndex(pointcloud_fields[i]) < data;
+    }
+
+    if (image) decoder->shape_ = SHAPE_IMAGE;
+    if (multiarray) decoder->shape_ = SHAPE_MULTIARRAY;
+    if (pointcloud) decoder->shape_ = SHAPE_POINTCLOUD;
+    if (datatype == "sensor_msgs/CompressedImage" && decoder->fields_[data].type == UINT8) decoder->shape_ = SHAPE_COMPRESSED;
+    decoder->shape_field_ = data;
+  }
+
+  // the flattened layout is fixed unless there are variable-length arrays, the serialized length also depends on strings
+  decoder->flat_ = true;
+  decoder->fixed_length_ = true;
+  for(Fields::const_iterator field = decoder->fields_.begin(); field != decoder->fields_.end(); ++field) {
+    std::size_t count = field->is_array ? field->array_length : 1;
+    if (field->is_array && field->array_length == 0) decoder->flat_ = false;
+    if ((field->is_array && field->array_length == 0) || field->type == STRING) decoder->fixed_length_ = false;
+    if (field->is_array && field->array_length == 0 && field->type != STRING && field->type != MESSAGE) decoder->payload_ = true;
+    if (field->message) {
+      decoder->payload_ = decoder->payload_ || field->message->payload_;
+      decoder->flat_ = decoder->flat_ && field->message->flat_;
+      decoder->flat_size_ += count * field->message->flat_size_;
+      decoder->fixed_length_ = decoder->fixed_length_ && field->message->fixed_length_;
+      decoder->encoded_length_ += count * field->message->encoded_length_;
+    } else {
+      decoder->flat_size_ += count;
+      decoder->encoded_length_ += count * getSize(field->type);
+    }
+  }
+
+  return decoder;
+}
+
+void Decoder::invalidatePlans()
+{
+  ++generation_;
+}
+
+Decoder::PlanConstPtr Decoder::compile(const ConversionOptions::Snapshot& options) const
+{
+  if (plans_generation_ != generation_) {
+    plans_.clear();
+    plans_generation_ = generation_;
+  }
+
+  // only the options that affect the conversion distinguish plans
+  int key = (((options.type * ConversionOptions::NUMERIC_TYPE_MAX + options.numeric) * ConversionOptions::STRING_TYPE_MAX + options.strings) * 2 + (options.add_meta_data ? 1 : 0)) * 2 + (options.reshape ? 1 : 0);
+  key = ((key * ConversionOptions::POINTCLOUD_TYPE_MAX + options.pointcloud) * 2 + (options.remove_nan ? 1 : 0)) * 2 + (options.decompress ? 1 : 0);
+  std::map<int, PlanConstPtr>::const_iterator it = plans_.find(key);
+  if (it != plans_.end()) return it->second;
+
+  boost::shared_ptr<Plan> plan(new Plan);
+  plan->columnar = (options.type == ConversionOptions::MATLAB_COLUMNAR);
+  plan->supported = (options.type == ConversionOptions::MATLAB_STRUCT) || plan->columnar;
+  plan->add_meta_data = options.add_meta_data;
+  plan->strings = plan->columnar ? options.strings : ConversionOptions::STRINGS_CHAR;
+  plan->pointcloud = options.pointcloud;
+  plan->remove_nan = options.remove_nan;
+  plan->decompress = options.decompress;
+  if (shape_ == SHAPE_POINTCLOUD) {
+    plan->reshape = options.pointcloud != ConversionOptions::POINTCLOUD_RAW && !plan->columnar;
+  } else if (shape_ == SHAPE_COMPRESSED) {
+    plan->reshape = options.decompress && !plan->columnar;
+  } else {
+    plan->reshape = options.reshape && shape_ != SHAPE_NONE && !plan->columnar;
+  }
+  plan->transforms = plan->reshape;
+  plan->class_ids.resize(fields_.size());
+  plan->children.resize(fields_.size());
+
+  for(std::size_t i = 0; i < fields_.size(); ++i) {
+    plan->class_ids[i] = getClassID(fields_[i].type, options.numeric == ConversionOptions::NUMERIC_NATIVE);
+    if (!fields_[i].message) continue;
+
+    // nested messages are converted with their own default options, like in Conversion::toStruct(),
+    // but inherit the numeric, string, reshape, pointcloud and image options of the top-level message
+    const Decoder& child = *fields_[i].message;
+    ConversionOptions child_options(Conversion::defaultOptions());
+    if (child.getIntrospection()) child_options.merge(Conversion::perMessageOptions(child.getIntrospection()));
+    ConversionOptions::Snapshot child_snapshot = child_options.snapshot();
+    child_snapshot.numeric = options.numeric;
+    child_snapshot.strings = options.strings;
+    child_snapshot.reshape = options.reshape;
+    child_snapshot.pointcloud = options.pointcloud;
+    child_snapshot.remove_nan = options.remove_nan;
+    child_snapshot.decompress = options.decompress;
+    if (plan->columnar) child_snapshot.type = ConversionOptions::MATLAB_COLUMNAR;
+    plan->children[i] = child.compile(child_snapshot);
+    plan->supported = plan->supported && plan->children[i]->supported;
+    plan->transforms = plan->transforms || plan->children[i]->transforms;
+  }
+
+  plans_[key] = plan;
+  return plan;
+}
+
+bool Decoder::supports(const ConversionOptions& options) const
+{
+  return compile(options.snapshot())->supported;
+}
+
+mxArray *Decoder::decode(ros::serialization::IStream& stream, const ConversionOptions& options, mxArray *target, std::size_t index, std::size_t size) const
+{
+  return decode(stream, *compile(options.snapshot()), target, index, size);
+}
+
+mxArray *Decoder::decode(ros::serialization::IStream& stream, const Plan& plan, mxArray *target, std::size_t index, std::size_t size, Jobs *jobs) const
+{
+  if (plan.columnar) return decodeColumnar(stream, plan, target, index, size, jobs);
+
+  if (!target) target = mxCreateStructMatrix(1, size > 0 ? size : index + 1, field_names_.size(), const_cast<const char **>(field_names_.data()));
+
+  // add fields if number of fields is 0
+  if (mxGetNumberOfFields(target) == 0) {
+    for(std::vector<const char *>::const_iterator it = field_names_.begin(); it != field_names_.end(); ++it) {
+      mxAddField(target, *it);
+    }
+  }
+
+  // decode all fields in the order of the definition
+  int number_of_fields = mxGetNumberOfFields(target);
+  for(std::size_t i = 0; i < fields_.size(); ++i) {
+    int fieldnum = i;
+    if (fieldnum >= number_of_fields || std::strcmp(mxGetFieldNameByNumber(target, fieldnum), field_names_[i]) != 0) {
+      fieldnum = mxGetFieldNumber(target, field_names_[i]);
+    }
+    mxArray *value = (plan.reshape && i == shape_field_) ? decodeShaped(stream, plan, target, index, jobs) : 0;
+    if (!value) value = decodeField(stream, plan, i, jobs);
+    mxSetFieldByNumber(target, index, fieldnum, value);
+  }
+
+  // add meta data to the struct
+  if (plan.add_meta_data) {
+    if (mxGetFieldNumber(target, "DATATYPE") == -1) mxAddField(target, "DATATYPE");
+    mxSetField(target, index, "DATATYPE", mxCreateString(datatype_.c_str()));
+    if (mxGetFieldNumber(target, "MD5SUM") == -1) mxAddField(target, "MD5SUM");
+    mxSetField(target, index, "MD5SUM", mxCreateString(introspection_ ? introspection_->getMD5Sum() : ""));
+  }
+
+  return target;
+}
+
+mxArray *Decoder::decodeField(ros::serialization::IStream& stream, const Plan& plan, std::size_t i, Jobs *jobs) const
+{
+  const Field& field = fields_[i];
+  std::size_t count = 1;
+  if (field.is_array) count = (field.array_length > 0) ? field.array_length : read<uint32_t>(stream);
+
+  if (field.type == MESSAGE) {
+    mxArray *child = 0;
+    for(std::size_t j = 0; j < count; ++j) {
+      child = field.message->decode(stream, *plan.children[i], child, j, count, jobs);
+    }
+    return child;
+  }
+
+  if (field.type == STRING) {
+    if (!field.is_array) return mxCreateString(readString(stream).c_str());
+
+    mxArray *target = mxCreateCellMatrix(1, count);
+    for(std::size_t j = 0; j < count; ++j) {
+      mxSetCell(target, j, mxCreateString(readString(stream).c_str()));
+    }
+    return target;
+  }
+
+  const uint8_t *data = stream.advance(count * getSize(field.type));
+  return decodeNumeric(plan, i, data, count, jobs);
+}
+
+mxArray *Decoder::decodeArray(const Plan& plan, std::size_t i, const mxArray *target, std::size_t index, const uint8_t *data, std::size_t count, Jobs *jobs) const
+{
+  mxArray *value = (plan.reshape && i == shape_field_) ? decodeShaped(plan, target, index, data, count, jobs) : 0;
+  if (!value) value = decodeNumeric(plan, i, data, count, jobs);
+  return value;
+}
+
+// copies numeric arrays with their native type, large payloads are left to the jobs if given
+mxArray *Decoder::decodeNumeric(const Plan& plan, std::size_t i, const uint8_t *data, std::size_t count, Jobs *jobs) const
+{
+  const Field& field = fields_[i];
+  mxClassID class_id = plan.class_ids[i];
+  std::size_t length = count * getSize(field.type);
+  if (length < Jobs::MIN_LENGTH) jobs = 0;
+
+  if (class_id == mxLOGICAL_CLASS) {
+    mxArray *target = mxCreateLogicalMatrix(1, count);
+    if (jobs) jobs->toLogical(mxGetLogicals(target), data, count);
+    else convertToLogical(data, mxGetLogicals(target), count);
+    return target;
+  }
+
+  // the arrays are filled completely, so they do not need to be zeroed first
+  if (class_id != mxDOUBLE_CLASS || field.type == FLOAT64) {
+    mxArray *target = mxCreateUninitNumericMatrix(1, count, class_id, mxREAL);
+    if (jobs) jobs->copy(mxGetData(target), data, length);
+    else std::memcpy(mxGetData(target), data, length);
+    return target;
+  }
+
+  mxArray *target = mxCreateUninitNumericMatrix(1, count, mxDOUBLE_CLASS, mxREAL);
+  if (jobs) jobs->toDouble(mxGetPr(target), data, field.type, count);
+  else convertToDouble(data, field.type, mxGetPr(target), count);
+  return target;
+}
+
+mxArray *Decoder::decodeColumnar(ros::serialization::IStream& stream, const Plan& plan, mxArray *target, std::size_t index, std::size_t size, Jobs *jobs) const
+{
+  if (size == 0) size = index + 1;
+
+  // allocate one column per field for all rows
+  if (!target) {
+    target = mxCreateStructMatrix(1, 1, field_names_.size(), const_cast<const char **>(field_names_.data()));
+    for(std::size_t i = 0; i < fields_.size(); ++i) {
+      mxSetFieldByNumber(target, 0, i, createColumn(plan, i, size));
+    }
+
+    if (plan.add_meta_data) {
+      mxAddField(target, "DATATYPE");
+      mxSetField(target, 0, "DATATYPE", mxCreateString(datatype_.c_str()));
+      mxAddField(target, "MD5SUM");
+      mxSetField(target, 0, "MD5SUM", mxCreateString(introspection_ ? introspection_->getMD5Sum() : ""));
+    }
+  }
+
+  int number_of_fields = mxGetNumberOfFields(target);
+  for(std::size_t i = 0; i < fields_.size(); ++i) {
+    int fieldnum = i;
+    if (fieldnum >= number_of_fields || std::strcmp(mxGetFieldNameByNumber(target, fieldnum), field_names_[i]) != 0) {
+      fieldnum = mxGetFieldNumber(target, field_names_[i]);
+    }
+    mxArray *column = mxGetFieldByNumber(target, 0, fieldnum);
+    if (!column) throw Exception("Field " + fields_[i].name + " is missing in the columns of " + datatype_);
+
+    // dictionary-encoded strings are interned per batch
+    if (fields_[i].type == STRING && mxIsUint32(column)) {
+      if (!jobs) throw Exception("Dictionary-encoded strings can only be converted with jobs that hold the dictionary");
+      static_cast<uint32_t *>(mxGetData(column))[index] = jobs->intern(target, field_names_[i], column, readString(stream), plan.strings == ConversionOptions::STRINGS_CATEGORICAL);
+      continue;
+    }
+
+    decodeColumn(stream, plan, i, column, index, jobs);
+  }
+
+  return target;
+}
+
+mxArray *Decoder::createColumn(const Plan& plan, std::size_t i, std::size_t rows) const
+{
+  const Field& field = fields_[i];
+
+  // nested messages are columns of their own, rows of variable length are stored in cells
+  if (field.type == MESSAGE && !field.is_array) {
+    const Decoder& child = *field.message;
+    mxArray *columns = mxCreateStructMatrix(1, 1, child.field_names_.size(), const_cast<const char **>(child.field_names_.data()));
+    for(std::size_t j = 0; j < child.fields_.size(); ++j) {
+      mxSetFieldByNumber(columns, 0, j, child.createColumn(*plan.children[i], j, rows));
+    }
+    return columns;
+  }
+
+  if (field.type == STRING && !field.is_array && plan.strings != ConversionOptions::STRINGS_CHAR) {
+    return mxCreateNumericMatrix(rows, 1, mxUINT32_CLASS, mxREAL);
+  }
+
+  if (field.type == MESSAGE || field.type == STRING || (field.is_array && field.array_length == 0)) {
+    return mxCreateCellMatrix(rows, 1);
+  }
+
+  std::size_t columns = field.is_array ? field.array_length : 1;
+  if (plan.class_ids[i] == mxLOGICAL_CLASS) return mxCreateLogicalMatrix(rows, columns);
+  return mxCreateNumericMatrix(rows, columns, plan.class_ids[i], mxREAL);
+}
+
+void Decoder::decodeColumn(ros::serialization::IStream& stream, const Plan& plan, std::size_t i, mxArray *column, std::size_t row, Jobs *jobs) const
+{
+  const Field& field = fields_[i];
+
+  if (field.type == MESSAGE && !field.is_array) {
+    field.message->decodeColumnar(stream, *plan.children[i], column, row, 0, jobs);
+    return;
+  }
+
+  if (mxIsCell(column)) {
+    mxSetCell(column, row, decodeField(stream, plan, i, jobs));
+    return;
+  }
+
+  // element j of a fixed-size array is stored in column j
+  std::size_t rows = mxGetM(column);
+  std::size_t count = field.is_array ? field.array_length : 1;
+  mxClassID class_id = plan.class_ids[i];
+
+  if (class_id == mxLOGICAL_CLASS) {
+    mxLogical *x = mxGetLogicals(column);
+    const uint8_t *data = stream.advance(count);
+    for(std::size_t j = 0; j < count; ++j) x[row + j * rows] = (data[j] != 0);
+    return;
+  }
+
+  if (class_id != mxDOUBLE_CLASS || field.type == FLOAT64) {
+    std::size_t element_size = getSize(field.type);
+    uint8_t *x = static_cast<uint8_t *>(mxGetData(column));
+    const uint8_t *data = stream.advance(count * element_size);
+    for(std::size_t j = 0; j < count; ++j) std::memcpy(x + (row + j * rows) * element_size, data + j * element_size, element_size);
+    return;
+  }
+
+  double *x = mxGetPr(column);
+  if (count == 1) {
+    readDoubles(stream, field.type, x + row, 1);
+    return;
+  }
+
+  std::vector<double> values(count);
+  readDoubles(stream, field.type, values.data(), count);
+  for(std::size_t j = 0; j < count; ++j) x[row + j * rows] = values[j];
+}
+
+bool Decoder::isFlat() const
+{
+  return flat_ && flat_verified_ > 0;
+}
+
+std::size_t Decoder::getFlatColumns(const mxArray *source) const
+{
+  if (!isFlat() || !mxIsDouble(source) || mxIsComplex(source)) return 0;
+  if (mxGetM(source) == 1 && mxGetN(source) == flat_size_) return 1;
+  return (mxGetM(source) == flat_size_) ? mxGetN(source) : 0;
+}
+
+bool Decoder::needsFlatVerification() const
+{
+  return flat_ && flat_verified_ == 0;
+}
+
+void Decoder::verifyFlatLayout(std::size_t expanded_size) const
+{
+  flat_verified_ = (expanded_size == flat_size_) ? 1 : -1;
+}
+
+double *Decoder::flatten(ros::serialization::IStream& stream, double *x, std::vector<std::string> *strings) const
+{
+  for(Fields::const_iterator field = fields_.begin(); field != fields_.end(); ++field) {
+    std::size_t count = field->is_array ? field->array_length : 1;
+
+    if (field->type == MESSAGE) {
+      for(std::size_t j = 0; j < count; ++j) x = field->message->flatten(stream, x, strings);
+      continue;
+    }
+
+    if (field->type == STRING) {
+      for(std::size_t j = 0; j < count; ++j) {
+        std::string value = readString(stream);
+        if (strings) strings->push_back(value);
+        *x++ = std::numeric_limits<double>::quiet_NaN();
+      }
+      continue;
+    }
+
+    readDoubles(stream, field->type, x, count);
+    x += count;
+  }
+
+  return x;
+}
+
+const double *Decoder::unflatten(const double *x, uint8_t *&data) const
+{
+  for(Fields::const_iterator field = fields_.begin(); field != fields_.end(); ++field) {
+    std::size_t count = field->is_array ? field->array_length : 1;
+
+    if (field->type == MESSAGE) {
+      for(std::size_t j = 0; j < count; ++j) x = field->message->unflatten(x, data);
+      continue;
+    }
+
+    // strings are not part of the matrix and are published empty, like in Conversion::fromDoubleMatrix()
+    if (field->type == STRING) {
+      std::memset(data, 0, count * sizeof(uint32_t));
+      data += count * sizeof(uint32_t);
+      x += count;
+      continue;
+    }
+
+    switch(field->type) {
+      case BOOL:     castArray<double, bool>(x, data, count); break;
+      case INT8:     castArray<double, int8_t>(x, data, count); break;
+      case UINT8:    castArray<double, uint8_t>(x, data, count); break;
+      case INT16:    castArray<double, int16_t>(x, data, count); break;
+      case UINT16:   castArray<double, uint16_t>(x, data, count); break;
+      case INT32:    castArray<double, int32_t>(x, data, count); break;
+      case UINT32:   castArray<double, uint32_t>(x, data, count); break;
+      case INT64:    castArray<double, int64_t>(x, data, count); break;
+      case UINT64:   castArray<double, uint64_t>(x, data, count); break;
+      case FLOAT32:  castArray<double, float>(x, data, count); break;
+      case FLOAT64:  std::memcpy(data, x, count * sizeof(double)); break;
+      case TIME:     writeTimes<ros::Time>(x, data, count); break;
+      case DURATION: writeTimes<ros::Duration>(x, data, count); break;
+      default: throw Exception("Failed to serialize field " + field->name + ": unsupported type");
+    }
+    data += count * getSize(field->type);
+    x += count;
+  }
+
+  return x;
+}
+
+void Decoder::unflatten(const double *x, std::size_t columns, uint8_t *data, std::size_t stride) const
+{
+  std::size_t threads = std::min<std::size_t>(boost::thread::hardware_concurrency(), columns);
+  std::size_t chunk = std::max<std::size_t>(Jobs::CHUNK_LENGTH / std::max<std::size_t>(stride, 1), 1);
+  boost::atomic<std::size_t> next(0);
+  boost::atomic<bool> failed(false);
+
+  if (threads > 1 && columns * stride >= Jobs::PARALLEL_LENGTH) {
+    boost::thread_group workers;
+    for(std::size_t i = 1; i < threads; ++i) {
+      workers.create_thread(boost::bind(&unflattenColumns, this, x, flat_size_, columns, data, stride, chunk, &next, &failed));
+    }
+    unflattenColumns(this, x, flat_size_, columns, data, stride, chunk, &next, &failed);
+    workers.join_all();
+    if (!failed) return;
+  }
+
+  // serial path, also reports the error of a failed worker
+  for(std::size_t j = 0; j < columns; ++j) {
+    uint8_t *column = data + j * stride;
+    unflatten(x + j * flat_size_, column);
+  }
+}
+
+Decoder::Jobs::Jobs() : length_(0), images_(0) {}
+Decoder::Jobs::~Jobs() {}
+
+void Decoder::Jobs::add(Kind kind, FieldType type, void *target, const uint8_t *source, std::size_t count)
+{
+  // split large payloads so that they are spread over all threads
+  std::size_t size = (kind == COPY) ? 1 : getSize(type);
+  std::size_t chunk = CHUNK_LENGTH / size;
+  for(std::size_t offset = 0; offset < count; offset += chunk) {
+    Job job;
+    job.kind = kind;
+    job.type = type;
+    job.source = source + offset * size;
+    job.count = std::min(chunk, count - offset);
+    switch(kind) {
+      case COPY:    job.target = static_cast<uint8_t *>(target) + offset; break;
+      case LOGICAL: job.target = static_cast<mxLogical *>(target) + offset; break;
+      case DOUBLE:  job.target = static_cast<double *>(target) + offset; break;
+      default:      job.target = target; break;
+    }
+    jobs_.push_back(job);
+  }
+  length_ += count * size;
+}
+
+void Decoder::Jobs::copy(void *target, const uint8_t *source, std::size_t length)
+{
+  add(COPY, UINT8, target, source, length);
+}
+
+void Decoder::Jobs::toLogical(mxLogical *target, const uint8_t *source, std::size_t count)
+{
+  add(LOGICAL, BOOL, target, source, count);
+}
+
+void Decoder::Jobs::toDouble(double *target, const uint8_t *source, FieldType type, std::size_t count)
+{
+  add(DOUBLE, type, target, source, count);
+}
+
+void Decoder::Jobs::decompress(uint8_t *target, const uint8_t *source, std::size_t length, std::size_t height, std::size_t width, std::size_t channels)
+{
+  Job job;
+  job.kind = DECOMPRESS;
+  job.type = UINT8;
+  job.target = target;
+  job.source = source;
+  job.count = length;
+  job.height = height;
+  job.width = width;
+  job.channels = channels;
+  jobs_.push_back(job);
+  length_ += length;
+  ++images_;
+}
+
+std::vector<uint8_t>& Decoder::Jobs::hold(std::size_t size)
+{
+  buffers_.push_back(std::vector<uint8_t>(size));
+  return buffers_.back();
+}
+
+uint8_t *Decoder::Jobs::allocate(std::size_t size)
+{
+  blocks_.push_back(boost::shared_array<uint8_t>(new uint8_t[size]));
+  return blocks_.back().get();
+}
+
+void Decoder::Jobs::run()
+{
+  std::size_t threads = std::min<std::size_t>(boost::thread::hardware_concurrency(), jobs_.size());
+  boost::atomic<std::size_t> next(0);
+
+  // decoding images is expensive enough to run in parallel even for small batches
+  if (threads > 1 && (length_ >= PARALLEL_LENGTH || images_ > 1)) {
+    boost::thread_group workers;
+    for(std::size_t i = 1; i < threads; ++i) workers.create_thread(boost::bind(&Jobs::work, this, boost::ref(next)));
+    work(next);
+    workers.join_all();
+  } else {
+    work(next);
+  }
+
+  jobs_.clear();
+  buffers_.clear();
+  blocks_.clear();
+  length_ = 0;
+  images_ = 0;
+}
+
+uint32_t Decoder::Jobs::intern(mxArray *parent, const char *field, mxArray *index, const std::string& value, bool categorical)
+{
+  Dictionary& dictionary = dictionaries_[index];
+  if (!dictionary.parent) {
+    dictionary.parent = parent;
+    dictionary.field = field;
+    dictionary.categorical = categorical;
+  }
+
+  std::map<std::string, uint32_t>::const_iterator it = dictionary.ids.find(value);
+  if (it != dictionary.ids.end()) return it->second;
+
+  dictionary.values.push_back(value);
+  return dictionary.ids[value] = dictionary.values.size();
+}
+
+void Decoder::Jobs::finish()
+{
+  run();
+
+  // replace the index arrays by a struct with index and dictionary or by a categorical array
+  for(std::map<mxArray *, Dictionary>::iterator it = dictionaries_.begin(); it != dictionaries_.end(); ++it) {
+    mxArray *index = it->first;
+    Dictionary& dictionary = it->second;
+
+    mxArray *values = mxCreateCellMatrix(dictionary.values.size(), 1);
+    for(std::size_t i = 0; i < dictionary.values.size(); ++i) {
+      mxSetCell(values, i, mxCreateString(dictionary.values[i].c_str()));
+    }
+
+    int fieldnum = mxGetFieldNumber(dictionary.parent, dictionary.field.c_str());
+    if (dictionary.categorical) {
+      mxArray *valueset = mxCreateNumericMatrix(dictionary.values.size(), 1, mxUINT32_CLASS, mxREAL);
+      uint32_t *ids = static_cast<uint32_t *>(mxGetData(valueset));
+      for(std::size_t i = 0; i < dictionary.values.size(); ++i) ids[i] = i + 1;
+
+      mxArray *rhs[] = { index, valueset, values };
+      mxArray *result = 0;
+      mexCallMATLAB(1, &result, 3, rhs, "categorical");
+      mxSetFieldByNumber(dictionary.parent, 0, fieldnum, result);
+      mxDestroyArray(index);
+      mxDestroyArray(valueset);
+      mxDestroyArray(values);
+
+    } else {
+      static const char *fieldnames[] = { "index", "dictionary" };
+      mxArray *result = mxCreateStructMatrix(1, 1, 2, fieldnames);
+      mxSetField(result, 0, "index", index);
+      mxSetField(result, 0, "dictionary", values);
+      mxSetFieldByNumber(dictionary.parent, 0, fieldnum, result);
+    }
+  }
+
+  dictionaries_.clear();
+}
+
+void Decoder::Jobs::work(boost::atomic<std::size_t>& next) const
+{
+  for(std::size_t i = next++; i < jobs_.size(); i = next++) {
+    const Job& job = jobs_[i];
+    switch(job.kind) {
+      case COPY:    std::memcpy(job.target, job.source, job.count); break;
+      case LOGICAL: convertToLogical(job.source, static_cast<mxLogical *>(job.target), job.count); break;
+      case DOUBLE:  convertToDouble(job.source, job.type, static_cast<double *>(job.target), job.count); break;
+      case DECOMPRESS:
+        if (!decompressImage(job.source, job.count, static_cast<uint8_t *>(job.target), job.height, job.width, job.channels)) {
+          ROS_WARN("failed to decode a compressed image");
+          std::memset(job.target, 0, job.height * job.width * job.channels);
+        }
+        break;
+    }
+  }
+}
+
+bool Decoder::encode(const mxArray *source, std::size_t index, std::vector<uint8_t>& buffer) const
+{
+  if (source && !mxIsStruct(source)) return false;
+  if (source && index >= mxGetNumberOfElements(source)) throw Exception("Index out of bounds");
+
+  // offsets of the fields of images and MultiArrays, on the stack for the known message types
+  std::size_t stack_offsets[8];
+  std::vector<std::size_t> heap_offsets;
+  std::size_t *offsets = stack_offsets;
+  if (shape_ != SHAPE_NONE && fields_.size() > sizeof(stack_offsets)/sizeof(*stack_offsets)) {
+    heap_offsets.resize(fields_.size());
+    offsets = heap_offsets.data();
+  }
+
+  // missing fields are encoded with their default value
+  int number_of_fields = source ? mxGetNumberOfFields(source) : 0;
+  for(std::size_t i = 0; i < fields_.size(); ++i) {
+    const mxArray *field_source = getFieldSource(source, index, i, number_of_fields);
+
+    // N-D data arrays of images and MultiArrays are written in row-major order
+    if (isShapedField(i, field_source)) {
+      if (!encodeShaped(source, index, field_source, offsets, buffer)) return false;
+      continue;
+    }
+
+    if (shape_ != SHAPE_NONE) offsets[i] = buffer.size();
+    if (!encodeField(field_source, fields_[i], buffer)) return false;
+  }
+  return true;
+}
+
+bool Decoder::encodeField(const mxArray *source, const Field& field, std::vector<uint8_t>& buffer) const
+{
+  std::size_t count = field.is_array ? field.array_length : 1;
+  if (source) {
+    count = mxIsChar(source) ? 1 : mxGetNumberOfElements(source);
+    if (field.is_array && field.array_length > 0 && count != field.array_length) throw Exception("Failed to parse field " + field.name + ": Array field must have length " + boost::lexical_cast<std::string>(field.array_length));
+    if (!field.is_array && count != 1) throw Exception("Failed to parse field " + field.name + ": Scalar field must have exactly length 1");
+  }
+  if (field.is_array && field.array_length == 0) write<uint32_t>(buffer, count);
+
+  if (field.type == MESSAGE) {
+    // other representations of nested messages are left to the introspection path
+    if (source && count > 0 && !mxIsStruct(source)) return false;
+    for(std::size_t j = 0; j < count; ++j) {
+      if (!field.message->encode(source, j, buffer)) return false;
+    }
+    return true;
+  }
+
+  if (field.type == STRING) {
+    for(std::size_t j = 0; j < count; ++j) {
+      if (!source) {
+        write<uint32_t>(buffer, 0);
+      } else if (mxIsCell(source) && mxIsChar(mxGetCell(source, j))) {
+        writeString(buffer, mxGetCell(source, j));
+      } else if (mxIsChar(source) && j == 0) {
+        writeString(buffer, source);
+      } else {
+        throw Exception("Failed to parse string field " + field.name + ": Array must be a cell string or a character array");
+      }
+    }
+    return true;
+  }
+
+  if (source && !mxIsNumeric(source) && !mxIsLogical(source)) throw Exception("Failed to parse field " + field.name + ": Array must be a numeric array");
+
+  uint8_t *data = grow(buffer, count * getSize(field.type));
+  if (!source || count == 0) return true;
+
+  // copy arrays that already have the native type
+  if (field.type != TIME && field.type != DURATION && mxGetClassID(source) == getClassID(field.type)) {
+    std::memcpy(data, mxGetData(source), count * getSize(field.type));
+    return true;
+  }
+
+  switch(field.type) {
+    case BOOL:     writeNumeric<bool>(source, data, count); break;
+    case INT8:     writeNumeric<int8_t>(source, data, count); break;
+    case UINT8:    writeNumeric<uint8_t>(source, data, count); break;
+    case INT16:    writeNumeric<int16_t>(source, data, count); break;
+    case UINT16:   writeNumeric<uint16_t>(source, data, count); break;
+    case INT32:    writeNumeric<int32_t>(source, data, count); break;
+    case UINT32:   writeNumeric<uint32_t>(source, data, count); break;
+    case INT64:    writeNumeric<int64_t>(source, data, count); break;
+    case UINT64:   writeNumeric<uint64_t>(source, data, count); break;
+    case FLOAT32:  writeNumeric<float>(source, data, count); break;
+    case FLOAT64:  writeNumeric<double>(source, data, count); break;
+    case TIME:     writeTimes<ros::Time>(source, data, count); break;
+    case DURATION: writeTimes<ros::Duration>(source, data, count); break;
+    default: throw Exception("Failed to serialize field " + field.name + ": unsupported type");
+  }
+
+  return true;
+}
+
+std::size_t Decoder::getEncodedLength(const mxArray *source, std::size_t index) const
+{
+  if (fixed_length_) return encoded_length_;
+  if (source && (!mxIsStruct(source) || index >= mxGetNumberOfElements(source))) return 0;
+
+  std::size_t length = 0;
+  int number_of_fields = source ? mxGetNumberOfFields(source) : 0;
+  for(std::size_t i = 0; i < fields_.size(); ++i) {
+    const mxArray *field_source = getFieldSource(source, index, i, number_of_fields);
+    if (isShapedField(i, field_source)) {
+      std::size_t element_size = (shape_ == SHAPE_IMAGE) ? mxGetElementSize(field_source) : getSize(fields_[i].type);
+      length += sizeof(uint32_t) + mxGetNumberOfElements(field_source) * element_size;
+      continue;
+    }
+    length += getEncodedFieldLength(field_source, fields_[i]);
+  }
+  return length;
+}
+
+std::size_t Decoder::getEncodedFieldLength(const mxArray *source, const Field& field) const
+{
+  std::size_t count = field.is_array ? field.array_length : 1;
+  if (source) count = mxIsChar(source) ? 1 : mxGetNumberOfElements(source);
+  std::size_t length = (field.is_array && field.array_length == 0) ? sizeof(uint32_t) : 0;
+
+  if (field.type == MESSAGE) {
+    if (field.message->fixed_length_) return length + count * field.message->encoded_length_;
+    for(std::size_t j = 0; j < count; ++j) {
+      length += field.message->getEncodedLength((source && mxIsStruct(source)) ? source : 0, j);
+    }
+    return length;
+  }
+
+  if (field.type == STRING) {
+    for(std::size_t j = 0; j < count; ++j) {
+      length += sizeof(uint32_t);
+      if (source && mxIsCell(source) && mxGetCell(source, j)) {
+        length += mxGetNumberOfElements(mxGetCell(source, j));
+      } else if (source && mxIsChar(source) && j == 0) {
+        length += mxGetNumberOfElements(source);
+      }
+    }
+    return length;
+  }
+
+  return length + count * getSize(field.type);
+}
+
+bool Decoder::isShapedField(std::size_t i, const mxArray *value) const
+{
+  return (shape_ == SHAPE_IMAGE || shape_ == SHAPE_MULTIARRAY) && i == shape_field_ && value && isShapedArray(value);
+}
+
+// structs converted by decode() have their fields in the order of the definition, so the position is tried first
+const mxArray *Decoder::getFieldSource(const mxArray *source, std::size_t index, std::size_t i, int number_of_fields) const
+{
+  if (!source) return 0;
+  int fieldnum = i;
+  if (fieldnum >= number_of_fields || std::strcmp(mxGetFieldNameByNumber(source, fieldnum), field_names_[i]) != 0) {
+    fieldnum = mxGetFieldNumber(source, field_names_[i]);
+  }
+  return (fieldnum >= 0) ? mxGetFieldByNumber(source, index, fieldnum) : 0;
+}
+
+std::size_t Decoder::getFieldIndex(const std::string& name) const
+{
+  for(std::size_t i = 0; i < fields_.size(); ++i) {
+    if (fields_[i].name == name) return i;
+  }
+  return fields_.size();
+}
+
+// Decodes the data field of an image or MultiArray into a column-major array with the shape given by
+// the fields that have already been decoded into target. Returns 0 without reading from the stream
+// if the shape cannot be determined, so that the field is decoded as flat vector instead.
+mxArray *Decoder::decodeShaped(ros::serialization::IStream& stream, const Plan& plan, const mxArray *target, std::size_t index, Jobs *jobs) const
+{
+  const Field& field = fields_[shape_field_];
+  if (stream.getLength() < sizeof(uint32_t)) return 0;
+
+  uint32_t count;
+  std::memcpy(&count, stream.getData(), sizeof(count));
+  std::size_t length = count * getSize(field.type);
+  if (stream.getLength() < sizeof(uint32_t) + length) return 0;
+
+  mxArray *result = decodeShaped(plan, target, index, stream.getData() + sizeof(uint32_t), count, jobs);
+  if (result) stream.advance(sizeof(uint32_t) + length);
+  return result;
+}
+
+mxArray *Decoder::decodeShaped(const Plan& plan, const mxArray *target, std::size_t index, const uint8_t *data, std::size_t count, Jobs *jobs) const
+{
+  const Field& field = fields_[shape_field_];
+  std::size_t length = count * getSize(field.type);
+  if (!target) return 0;
+
+  mxArray *result = 0;
+  if (shape_ == SHAPE_POINTCLOUD) {
+    result = decodePointCloud(plan, target, index, data, length);
+
+  } else if (shape_ == SHAPE_COMPRESSED) {
+    result = decodeCompressedImage(data, length, jobs);
+
+  } else if (shape_ == SHAPE_IMAGE) {
+    std::size_t height = getScalarField(target, index, "height");
+    std::size_t width = getScalarField(target, index, "width");
+    std::size_t step = getScalarField(target, index, "step");
+    bool is_bigendian = getScalarField(target, index, "is_bigendian") != 0.0;
+
+    const mxArray *encoding = mxGetField(target, index, "encoding");
+    FieldType type;
+    std::size_t channels;
+    if (!encoding || !mxIsChar(encoding) || !parseEncoding(Options::getString(encoding), type, channels)) return 0;
+
+    std::size_t element_size = getSize(type);
+    if (is_bigendian && element_size > 1) return 0;
+    if (width * channels * element_size > step || height * step > length) return 0;
+
+    bool to_double = (plan.class_ids[shape_field_] == mxDOUBLE_CLASS && type != FLOAT64);
+    mwSize dims[] = { height, width, channels };
+    result = mxCreateUninitNumericArray(channels > 1 ? 3 : 2, dims, to_double ? mxDOUBLE_CLASS : getClassID(type), mxREAL);
+
+    // one plane per channel
+    std::size_t target_size = mxGetElementSize(result);
+    for(std::size_t c = 0; c < channels; ++c) {
+      uint8_t *plane = static_cast<uint8_t *>(mxGetData(result)) + c * height * width * target_size;
+      if (to_double) {
+        transposeToDouble(plane, target_size, height * target_size, data + c * element_size, step, channels * element_size, height, width, type);
+      } else {
+        transpose(plane, target_size, height * target_size, data + c * element_size, step, channels * element_size, height, width, element_size);
+      }
+    }
+
+  } else if (shape_ == SHAPE_MULTIARRAY) {
+    const mxArray *layout = mxGetField(target, index, "layout");
+    const mxArray *dim = (layout && mxIsStruct(layout)) ? mxGetField(layout, 0, "dim") : 0;
+    if (!dim || !mxIsStruct(dim) || mxGetNumberOfElements(dim) < 2) return 0;
+
+    // element strides of the source as given by the layout (or dense if not given) and of the column-major target
+    std::size_t k = mxGetNumberOfElements(dim);
+    std::vector<std::size_t> sizes(k), source_strides(k), target_strides(k);
+    std::vector<mwSize> dims(k);
+    for(std::size_t j = 0; j < k; ++j) dims[j] = sizes[j] = getScalarField(dim, j, "size");
+    source_strides[k - 1] = 1;
+    for(std::size_t j = k - 1; j > 0; --j) {
+      std::size_t stride = getScalarField(dim, j, "stride");
+      source_strides[j - 1] = stride ? stride : source_strides[j] * sizes[j];
+    }
+    target_strides[0] = 1;
+    for(std::size_t j = 1; j < k; ++j) target_strides[j] = target_strides[j - 1] * sizes[j - 1];
+
+    std::size_t offset = getScalarField(layout, 0, "data_offset");
+    // the last element read must be in the data, unless the array is empty
+    std::size_t last = offset;
+    bool empty = false;
+    for(std::size_t j = 0; j < k; ++j) {
+      if (sizes[j] == 0) { empty = true; break; }
+      last += (sizes[j] - 1) * source_strides[j];
+    }
+    if (!empty && last >= count) return 0;
+
+    std::size_t element_size = getSize(field.type);
+    bool to_double = (plan.class_ids[shape_field_] == mxDOUBLE_CLASS && field.type != FLOAT64);
+    result = mxCreateUninitNumericArray(k, dims.data(), to_double ? mxDOUBLE_CLASS : getClassID(field.type), mxREAL);
+    std::size_t target_size = mxGetElementSize(result);
+
+    // transpose the first and the last dimension for every slice of the dimensions in between
+    std::vector<std::size_t> source_offsets, target_offsets;
+    if (mxGetNumberOfElements(result) > 0) getSliceOffsets(sizes, source_strides, target_strides, source_offsets, target_offsets);
+    for(std::size_t i = 0; i < source_offsets.size(); ++i) {
+      uint8_t *t = static_cast<uint8_t *>(mxGetData(result)) + target_offsets[i] * target_size;
+      const uint8_t *s = data + (offset + source_offsets[i]) * element_size;
+      if (to_double) {
+        transposeToDouble(t, target_size, target_strides[k - 1] * target_size, s, source_strides[0] * element_size, element_size, sizes[0], sizes[k - 1], field.type);
+      } else {
+        transpose(t, target_size, target_strides[k - 1] * target_size, s, source_strides[0] * element_size, element_size, sizes[0], sizes[k - 1], element_size);
+      }
+    }
+  }
+
+  return result;
+}
+
+// Splits the data field of a point cloud into its point fields, either as NxK matrix (HxWxK for organized
+// clouds) or as struct with one Nxcount (HxWxcount) array per field. Values of mixed types are converted to
+// double. Returns 0 if the layout given by the fields that have already been decoded is not supported.
+mxArray *Decoder::decodePointCloud(const Plan& plan, const mxArray *target, std::size_t index, const uint8_t *data, std::size_t length) const
+{
+  std::size_t height = getScalarField(target, index, "height");
+  std::size_t width = getScalarField(target, index, "width");
+  std::size_t point_step = getScalarField(target, index, "point_step");
+  std::size_t row_step = getScalarField(target, index, "row_step");
+  bool is_bigendian = getScalarField(target, index, "is_bigendian") != 0.0;
+  std::size_t points = height * width;
+  if (points > 0 && (width * point_step > row_step || (height - 1) * row_step + width * point_step > length)) return 0;
+
+  const mxArray *fields = mxGetField(target, index, "fields");
+  if (!fields || !mxIsStruct(fields) || mxIsEmpty(fields)) return 0;
+
+  std::vector<PointField> point_fields(mxGetNumberOfElements(fields));
+  std::size_t columns = 0;
+  bool mixed = false;
+  for(std::size_t j = 0; j < point_fields.size(); ++j) {
+    PointField& point_field = point_fields[j];
+    const mxArray *name = mxGetField(fields, j, "name");
+    if (!name || !mxIsChar(name) || !getPointFieldType(getScalarField(fields, j, "datatype"), point_field.type)) return 0;
+    point_field.name = Options::getString(name);
+    point_field.offset = getScalarField(fields, j, "offset");
+    point_field.count = getScalarField(fields, j, "count");
+
+    std::size_t element_size = getSize(point_field.type);
+    if (is_bigendian && element_size > 1) return 0;
+    if (points > 0 && point_field.offset + point_field.count * element_size > point_step) return 0;
+    mixed = mixed || point_field.type != point_fields[0].type;
+    columns += point_field.count;
+  }
+
+  // points with NaN in x, y or z (or in any floating point field if there are no coordinates) are dropped,
+  // which flattens organized clouds
+  bool organized = height > 1 && !plan.remove_nan;
+  std::vector<std::size_t> keep;
+  if (plan.remove_nan) {
+    std::vector<const PointField *> checked;
+    for(std::size_t j = 0; j < point_fields.size(); ++j) {
+      const std::string& name = point_fields[j].name;
+      if (name == "x" || name == "y" || name == "z") checked.push_back(&point_fields[j]);
+    }
+    for(std::size_t j = 0; checked.empty() && j < point_fields.size(); ++j) {
+      if (point_fields[j].type == FLOAT32 || point_fields[j].type == FLOAT64) checked.push_back(&point_fields[j]);
+    }
+
+    keep.reserve(points);
+    for(std::size_t h = 0; h < height; ++h) {
+      const uint8_t *point = data + h * row_step;
+      for(std::size_t w = 0; w < width; ++w, point += point_step) {
+        bool valid = true;
+        for(std::vector<const PointField *>::const_iterator it = checked.begin(); valid && it != checked.end(); ++it) {
+          std::size_t element_size = getSize((*it)->type);
+          for(std::size_t c = 0; valid && c < (*it)->count; ++c) valid = !isNaN(point + (*it)->offset + c * element_size, (*it)->type);
+        }
+        if (valid) keep.push_back(h * width + w);
+      }
+    }
+  }
+  bool compact = plan.remove_nan && keep.size() < points;
+  bool to_double = (plan.class_ids[shape_field_] == mxDOUBLE_CLASS);
+
+  mxArray *result = 0;
+  if (plan.pointcloud == ConversionOptions::POINTCLOUD_FIELDS) {
+    result = mxCreateStructMatrix(1, 1, 0, 0);
+    for(std::vector<PointField>::const_iterator it = point_fields.begin(); it != point_fields.end(); ++it) {
+      std::string name = getPointFieldName(it->name);
+      if (mxGetFieldNumber(result, name.c_str()) != -1) continue;
+
+      mwSize dims[] = { organized ? height : points, organized ? width : it->count, it->count };
+      mxArray *column = mxCreateUninitNumericArray(organized && it->count > 1 ? 3 : 2, dims, to_double ? mxDOUBLE_CLASS : getClassID(it->type), mxREAL);
+      std::size_t target_size = mxGetElementSize(column);
+      if (points > 0 && it->count > 0) {
+        gatherPointField(static_cast<uint8_t *>(mxGetData(column)), target_size, to_double, data + it->offset, it->type, it->count, height, width, point_step, row_step, organized);
+      }
+      if (compact) {
+        compactRows(static_cast<uint8_t *>(mxGetData(column)), points, it->count, keep, target_size);
+        mxSetM(column, keep.size());
+      }
+      mxSetFieldByNumber(result, 0, mxAddField(result, name.c_str()), column);
+    }
+
+  } else {
+    to_double = to_double || mixed;
+    mwSize dims[] = { organized ? height : points, organized ? width : columns, columns };
+    result = mxCreateUninitNumericArray(organized ? 3 : 2, dims, to_double ? mxDOUBLE_CLASS : getClassID(point_fields[0].type), mxREAL);
+    std::size_t target_size = mxGetElementSize(result);
+
+    // consecutive fields of the same type (like x, y and z) are gathered at once
+    std::size_t column = 0;
+    for(std::size_t j = 0; j < point_fields.size() && points > 0; ) {
+      const PointField& first = point_fields[j];
+      std::size_t element_size = getSize(first.type);
+      std::size_t count = first.count;
+      for(++j; j < point_fields.size(); ++j) {
+        if (point_fields[j].type != first.type || point_fields[j].offset != first.offset + count * element_size) break;
+        count += point_fields[j].count;
+      }
+      if (count == 0) continue;
+
+      uint8_t *target = static_cast<uint8_t *>(mxGetData(result)) + column * points * target_size;
+      gatherPointField(target, target_size, to_double, data + first.offset, first.type, count, height, width, point_step, row_step, organized);
+      column += count;
+    }
+
+    if (compact) {
+      compactRows(static_cast<uint8_t *>(mxGetData(result)), points, columns, keep, target_size);
+      mxSetM(result, keep.size());
+    }
+  }
+
+  return result;
+}
+
+// Decodes the JPEG or PNG data of a compressed image into a HxWxC uint8 array. The header is parsed
+// immediately to allocate the array, the image itself is decoded by the jobs of a batch if given.
+mxArray *Decoder::decodeCompressedImage(const uint8_t *data, std::size_t length, Jobs *jobs) const
+{
+  std::size_t height, width, channels;
+  if (!readImageHeader(data, length, height, width, channels) || height * width * channels == 0) return 0;
+
+  mwSize dims[] = { height, width, channels };
+  mxArray *result = mxCreateUninitNumericArray(channels > 1 ? 3 : 2, dims, mxUINT8_CLASS, mxREAL);
+  uint8_t *target = static_cast<uint8_t *>(mxGetData(result));
+  if (jobs) {
+    jobs->decompress(target, data, length, height, width, channels);
+  } else if (!decompressImage(data, length, target, height, width, channels)) {
+    mxDestroyArray(result);
+    return 0;
+  }
+  return result;
+}
+
+// Writes the column-major data array of an image or MultiArray in row-major order. The height, width
+// and step of images are set from the dimensions of data, the layout of MultiArrays has to match or
+// false is returned.
+bool Decoder::encodeShaped(const mxArray *source, std::size_t index, const mxArray *data, const std::size_t *offsets, std::vector<uint8_t>& buffer) const
+{
+  const Field& field = fields_[shape_field_];
+  std::size_t k = mxGetNumberOfDimensions(data);
+  const mwSize *dims = mxGetDimensions(data);
+  const uint8_t *source_data = static_cast<const uint8_t *>(mxGetData(data));
+  std::size_t source_size = mxGetElementSize(data);
+  bool from_double = mxIsDouble(data);
+
+  if (shape_ == SHAPE_IMAGE) {
+    if (k > 3) throw Exception("Failed to parse field " + field.name + ": Image data must have at most 3 dimensions");
+    std::size_t height = dims[0], width = dims[1], channels = (k > 2) ? dims[2] : 1;
+
+    // the element type is given by the encoding or by the class of data
+    const mxArray *encoding = mxGetField(source, index, "encoding");
+    std::string encoding_string = (encoding && mxIsChar(encoding)) ? Options::getString(encoding) : std::string();
+    FieldType type = FLOAT64;
+    std::size_t encoding_channels = channels;
+    if (encoding_string.empty()) {
+      switch(mxGetClassID(data)) {
+        case mxINT8_CLASS:   type = INT8; break;
+        case mxUINT8_CLASS:  type = UINT8; break;
+        case mxINT16_CLASS:  type = INT16; break;
+        case mxUINT16_CLASS: type = UINT16; break;
+        case mxINT32_CLASS:  type = INT32; break;
+        case mxSINGLE_CLASS: type = FLOAT32; break;
+        case mxDOUBLE_CLASS: type = FLOAT64; break;
+        default: throw Exception("Failed to parse field " + field.name + ": Image data has an unsupported class");
+      }
+    } else if (!parseEncoding(encoding_string, type, encoding_channels)) {
+      throw Exception("Failed to parse field " + field.name + ": Cannot reshape image data with encoding " + encoding_string);
+    }
+    if (encoding_channels != channels) throw Exception("Failed to parse field " + field.name + ": Encoding " + encoding_string + " does not match the number of channels of the image data");
+    if (!from_double && mxGetClassID(data) != getClassID(type)) throw Exception("Failed to parse field " + field.name + ": Image data must be double or match the encoding " + encoding_string);
+
+    std::size_t element_size = getSize(type);
+    uint32_t header[] = { static_cast<uint32_t>(height), static_cast<uint32_t>(width), static_cast<uint32_t>(width * channels * element_size) };
+    const char *header_fields[] = { "height", "width", "step" };
+    for(std::size_t i = 0; i < 3; ++i) {
+      std::memcpy(buffer.data() + offsets[getFieldIndex(header_fields[i])], &header[i], sizeof(uint32_t));
+    }
+
+    std::size_t step = header[2];
+    write<uint32_t>(buffer, height * step);
+    uint8_t *target = grow(buffer, height * step);
+    for(std::size_t c = 0; c < channels; ++c) {
+      const uint8_t *plane = source_data + c * height * width * source_size;
+      if (from_double && type != FLOAT64) {
+        transposeFromDouble(target + c * element_size, step, channels * element_size, plane, source_size, height * source_size, height, width, type);
+      } else {
+        transpose(target + c * element_size, step, channels * element_size, plane, source_size, height * source_size, height, width, element_size);
+      }
+    }
+    return true;
+  }
+
+  if (shape_ == SHAPE_MULTIARRAY) {
+    if (!from_double && mxGetClassID(data) != getClassID(field.type)) throw Exception("Failed to parse field " + field.name + ": Array must be double or of the native type of the MultiArray");
+
+    // the layout has already been written and has to describe the dense array, trailing singleton dimensions aside
+    const mxArray *layout = source ? mxGetField(source, index, "layout") : 0;
+    const mxArray *dim = (layout && mxIsStruct(layout)) ? mxGetField(layout, 0, "dim") : 0;
+    std::size_t layout_k = (dim && mxIsStruct(dim)) ? mxGetNumberOfElements(dim) : 0;
+    if (layout_k < 2 || layout_k < k || getScalarField(layout, 0, "data_offset") != 0.0) return false;
+    double stride = 1.0;
+    for(std::size_t j = layout_k; j-- > 0; ) {
+      double size = (j < k) ? dims[j] : 1;
+      stride *= size;
+      double layout_stride = getScalarField(dim, j, "stride");
+      if (getScalarField(dim, j, "size") != size || (layout_stride != 0.0 && layout_stride != stride)) return false;
+    }
+
+    std::vector<std::size_t> sizes(dims, dims + k), source_strides(k), target_strides(k);
+    source_strides[0] = 1;
+    for(std::size_t j = 1; j < k; ++j) source_strides[j] = source_strides[j - 1] * sizes[j - 1];
+    target_strides[k - 1] = 1;
+    for(std::size_t j = k - 1; j > 0; --j) target_strides[j - 1] = target_strides[j] * sizes[j];
+
+    std::size_t count = mxGetNumberOfElements(data);
+    std::size_t element_size = getSize(field.type);
+    write<uint32_t>(buffer, count);
+    uint8_t *target = grow(buffer, count * element_size);
+
+    std::vector<std::size_t> source_offsets, target_offsets;
+    if (count > 0) getSliceOffsets(sizes, source_strides, target_strides, source_offsets, target_offsets);
+    for(std::size_t i = 0; i < source_offsets.size(); ++i) {
+      uint8_t *t = target + target_offsets[i] * element_size;
+      const uint8_t *s = source_data + source_offsets[i] * source_size;
+      if (from_double && field.type != FLOAT64) {
+        transposeFromDouble(t, target_strides[0] * element_size, element_size, s, source_size, source_strides[k - 1] * source_size, sizes[0], sizes[k - 1], field.type);
+      } else {
+        transpose(t, target_strides[0] * element_size, element_size, s, source_size, source_strides[k - 1] * source_size, sizes[0], sizes[k - 1], element_size);
+      }
+    }
+    return true;
+  }
+
+  return false;
+}
+
+} // namespace rosmatlab
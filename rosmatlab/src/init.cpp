@@ -46,6 +46,7 @@ namespace rosmatlab {
       node_handle_ = new ros::NodeHandle();
     }
 
+    // Subscribers buffer messages in single-producer queues, so there must be exactly one spinner thread.
     if (!spinner_) {
       spinner_ = new ros::AsyncSpinner(1);
       spinner_->start();
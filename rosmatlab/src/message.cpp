@@ -28,6 +28,7 @@
 
 #include <rosmatlab/message.h>
 #include <rosmatlab/conversion.h>
+#include <rosmatlab/decoder.h>
 #include <rosmatlab/options.h>
 #include <rosmatlab/log.h>
 #include <rosmatlab/exception.h>
@@ -66,6 +67,7 @@ mxArray *message_constructor(const MessagePtr& message, int nlhs, mxArray *plhs[
       if (nrhs == 2) {
         const mxArray *default_options = prhs[1];
         Conversion::perMessageOptions(message).merge(ConversionOptions(1, &default_options));
+        Decoder::invalidatePlans();
       }
       return Conversion::perMessageOptions(message).toMatlab();
     }
@@ -40,11 +40,14 @@ void mexFunction( int nlhs, mxArray *plhs[],
     methods
       .add("advertise", &Publisher::advertise)
       .add("publish", &Publisher::publish)
+      .add("schedule", &Publisher::schedule)
+      .add("cancel", &Publisher::cancel)
       .add("getTopic", &Publisher::getTopic)
       .add("getDataType", &Publisher::getDataType)
       .add("getMD5Sum", &Publisher::getMD5Sum)
       .add("getNumSubscribers", &Publisher::getNumSubscribers)
       .add("isLatched", &Publisher::isLatched)
+      .add("getStatistics", &Publisher::getStatistics)
       .throwOnUnknown();
   }
 
@@ -47,6 +47,7 @@ void mexFunction( int nlhs, mxArray *plhs[],
       .add("getNumPublishers", &Subscriber::getNumPublishers)
       .add("getConnectionHeader", &Subscriber::getConnectionHeader)
       .add("getReceiptTime", &Subscriber::getReceiptTime)
+      .add("getStatistics", &Subscriber::getStatistics)
       .throwOnUnknown();
   }
 
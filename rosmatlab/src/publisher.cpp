@@ -35,22 +35,91 @@
 
 #include <ros/topic_manager.h>
 
+#include <boost/bind.hpp>
+#include <algorithm>
+#include <cmath>
+
+#include <time.h>
+#include <unistd.h>
+
+#if defined(_POSIX_TIMERS) && _POSIX_TIMERS > 0
+  #define ROSMATLAB_HAVE_CLOCK_NANOSLEEP
+#endif
+
 namespace rosmatlab {
 
 template <> const char *Object<Publisher>::class_name_ = "ros.Publisher";
+static const std::size_t DEFAULT_QUEUE_SIZE = 16;
+static const double MAX_PLAYBACK_SLEEP = 0.05;   // seconds, bounds the time cancel() waits for the playback thread
+static const double SIM_TIME_POLL = 0.001;       // seconds, simulated time can only be polled
+
+namespace {
+  ros::SerializedMessage getSerializedMessage(const ros::SerializedMessage& m) { return m; }
+
+  // time of the playback clock in seconds: the ROS time if it is simulated, else the realtime clock for
+  // absolute and the monotonic clock for relative time stamps
+  double getClockTime(bool sim_time, bool absolute) {
+    if (sim_time) return ros::Time::now().toSec();
+#ifdef ROSMATLAB_HAVE_CLOCK_NANOSLEEP
+    timespec now;
+    clock_gettime(absolute ? CLOCK_REALTIME : CLOCK_MONOTONIC, &now);
+    return now.tv_sec + 1e-9 * now.tv_nsec;
+#else
+    return ros::WallTime::now().toSec();
+#endif
+  }
+
+  void sleepClock(bool sim_time, bool absolute, double now, double until) {
+    if (sim_time) {
+      ros::WallDuration(std::min(until - now, SIM_TIME_POLL)).sleep();
+      return;
+    }
+#ifdef ROSMATLAB_HAVE_CLOCK_NANOSLEEP
+    // an absolute wakeup time is not delayed by the time spent in this function or by interrupts
+    timespec wakeup;
+    wakeup.tv_sec = static_cast<time_t>(until);
+    wakeup.tv_nsec = std::min(static_cast<long>((until - wakeup.tv_sec) * 1e9), 999999999L);
+    clock_nanosleep(absolute ? CLOCK_REALTIME : CLOCK_MONOTONIC, TIMER_ABSTIME, &wakeup, 0);
+#else
+    ros::WallDuration(until - now).sleep();
+#endif
+  }
+}
+
+Publisher::Outgoing::Outgoing()
+  : serializer(boost::bind(&getSerializedMessage, boost::cref(serialized)))
+{
+}
+
+// releases the buffer, so that the conversion can reuse it for the next message
+void Publisher::Outgoing::clear()
+{
+  serialized = ros::SerializedMessage();
+  message.reset();
+}
 
 Publisher::Publisher()
   : Object<Publisher>(this)
+  , async_(false), blocking_(false), queue_size_(0)
+  , sent_(0), dropped_(0), blocked_(0), blocked_time_(0), max_queued_(0)
+  , playing_(false), scheduled_(0), played_(0), first_sent_(0), last_sent_(0)
+  , jitter_sum_(0), jitter_squared_sum_(0), jitter_max_(0)
 {
 }
 
 Publisher::Publisher(int nrhs, const mxArray *prhs[])
   : Object<Publisher>(this)
+  , async_(false), blocking_(false), queue_size_(0)
+  , sent_(0), dropped_(0), blocked_(0), blocked_time_(0), max_queued_(0)
+  , playing_(false), scheduled_(0), played_(0), first_sent_(0), last_sent_(0)
+  , jitter_sum_(0), jitter_squared_sum_(0), jitter_max_(0)
 {
   if (nrhs > 0) advertise(nrhs, prhs);
 }
 
 Publisher::~Publisher() {
+  cancel();
+  stop();
   shutdown();
 }
 
@@ -60,8 +129,27 @@ mxArray *Publisher::advertise(int nrhs, const mxArray *prhs[])
     throw ArgumentException("Publisher.advertise", 2);
   }
 
+  // messages that are still queued are sent with the old options
+  cancel();
+  stop();
+
   options_ = ros::AdvertiseOptions();
+  bool async = false, blocking = false;
+  std::size_t queue_size = DEFAULT_QUEUE_SIZE;
   for(int i = 0; i < nrhs; i++) {
+    // key/value options follow the positional arguments
+    if (i >= 2 && Options::isString(prhs[i])) {
+      Options options(nrhs - i, prhs + i, true);
+      async = options.getBool("async");
+      blocking = options.getBool("blocking");
+      if (options.hasKey("depth")) {
+        if (options.getDouble("depth") < 1) throw Exception("Publisher.advertise", "depth must be positive");
+        queue_size = options.getDouble("depth");
+      }
+      options.throwOnUnused();
+      break;
+    }
+
     switch(i) {
       case 0:
         if (!Options::isString(prhs[i])) throw Exception("Publisher.advertise", "need a topic as 1st argument");
@@ -93,31 +181,260 @@ mxArray *Publisher::advertise(int nrhs, const mxArray *prhs[])
   options_.md5sum = introspection_->getMD5Sum();
   options_.message_definition = introspection_->getDefinition();
   options_.has_header = introspection_->hasHeader();
+  conversion_.reset(new Conversion(introspection_));
+  instance_.reset();
 
   *this = node_handle_.advertise(options_);
+  resolved_topic_ = ros::Publisher::getTopic();
+
+  async_ = async;
+  blocking_ = blocking;
+  sent_ = 0;
+  dropped_ = 0;
+  blocked_ = 0;
+  blocked_time_ = 0;
+  max_queued_ = 0;
+  if (async_) {
+    queue_.reset(new Queue(queue_size));
+    recycled_.reset(new Queue(queue_size + 2));
+    spare_.reset();
+    queue_size_ = queue_size;
+    thread_ = boost::thread(&Publisher::run, this);
+  }
+
   return mxCreateLogicalScalar(*this);
 }
 
 void Publisher::publish(int nrhs, const mxArray *prhs[])
 {
   if (nrhs < 1) throw ArgumentException("Publisher.publish", 1);
-  if (!introspection_) throw Exception("Publisher.publish", "unknown message type");
+  if (!introspection_ || !conversion_) throw Exception("Publisher.publish", "unknown message type");
 
-  MessagePtr message;
-  ros::SerializedMessage m;
-  m.type_info = &(introspection_->getTypeId());
-  Conversion conversion(introspection_);
+  Conversion& conversion = *conversion_;
+
+  // double matrices of messages with a flat layout are serialized as one batch, one column per message
+  if (*this && conversion.serializeColumns(prhs[0], batch_)) {
+    for(std::size_t i = 0; i < batch_.size(); ++i) {
+      OutgoingPtr queued = async_ ? acquire() : OutgoingPtr();
+      Outgoing& outgoing = async_ ? *queued : outgoing_;
+      outgoing.serialized = batch_[i];
+      dispatch(outgoing, queued);
+    }
+    batch_.clear();
+    return;
+  }
 
   std::size_t count = conversion.numberOfInstances(prhs[0]);
   for(std::size_t i = 0; i < count; ++i) {
-    message = conversion.fromMatlab(prhs[0], i);
-    if (!message) throw Exception("Publisher.publish", "failed to parse message of type " + options_.datatype);
+    OutgoingPtr queued = async_ ? acquire() : OutgoingPtr();
+    Outgoing& outgoing = async_ ? *queued : outgoing_;
+
+    // structs are serialized directly into the outgoing buffer, other representations are converted to a message first
+    outgoing.message.reset();
+    if (!*this || !conversion.serialize(prhs[0], i, outgoing.serialized)) {
+      // double matrices and strings overwrite all fields, so the same instance is reused if it is sent immediately
+      // (ros::Publisher::publish() serializes it before it returns)
+      if (!mxIsStruct(prhs[0]) && !async_) {
+        if (!instance_) instance_ = introspection_->introspect(introspection_->createInstance());
+        conversion.fromMatlab(instance_, prhs[0], i);
+        outgoing.message = instance_;
+      } else {
+        outgoing.message = conversion.fromMatlab(prhs[0], i);
+      }
+      if (!outgoing.message) throw Exception("Publisher.publish", "failed to parse message of type " + options_.datatype);
+    }
+
+    dispatch(outgoing, queued);
+  }
+}
+
+// converts the whole batch on the Matlab thread and hands it to a playback thread
+void Publisher::schedule(int nrhs, const mxArray *prhs[])
+{
+  if (nrhs < 2) throw ArgumentException("Publisher.schedule", 2);
+  if (!introspection_ || !conversion_ || !*this) throw Exception("Publisher.schedule", "unknown message type");
+
+  double rate = 1.0;
+  PlaybackPtr playback(new Playback);
+  playback->absolute = false;
+  playback->ros_time = false;
+  if (nrhs > 2) {
+    Options options(nrhs - 2, prhs + 2, true);
+    rate = options.getDouble("rate", 1.0);
+    playback->absolute = options.getBool("absolute");
+    std::string clock = options.getString("clock", "wall");
+    if (clock != "wall" && clock != "ros") throw Exception("Publisher.schedule", "clock must be either 'wall' or 'ros'");
+    playback->ros_time = (clock == "ros");
+    options.throwOnUnused();
+  }
+  if (!(rate > 0)) throw Exception("Publisher.schedule", "rate must be positive");
+  if (playback->absolute && rate != 1.0) throw Exception("Publisher.schedule", "rate is only supported for relative time stamps");
+
+  Conversion& conversion = *conversion_;
+  std::size_t count = conversion.numberOfInstances(prhs[0]);
+  if (!mxIsDouble(prhs[1]) || mxGetNumberOfElements(prhs[1]) != count) throw Exception("Publisher.schedule", "need one time stamp per message as 2nd argument");
+
+  const double *timestamps = mxGetPr(prhs[1]);
+  playback->times.resize(count);
+  for(std::size_t i = 0; i < count; ++i) {
+    if (!(timestamps[i] == timestamps[i]) || (i > 0 && timestamps[i] < timestamps[i - 1])) throw Exception("Publisher.schedule", "time stamps must be increasing");
+    playback->times[i] = playback->absolute ? timestamps[i] : (timestamps[i] - timestamps[0]) / rate;
+  }
+
+  // the playback thread only sends, so all messages are converted in advance
+  playback->messages.reserve(count);
+  if (conversion.serializeColumns(prhs[0], batch_)) {
+    for(std::size_t i = 0; i < batch_.size(); ++i) {
+      OutgoingPtr outgoing(new Outgoing);
+      outgoing->serialized = batch_[i];
+      playback->messages.push_back(outgoing);
+    }
+    batch_.clear();
+  } else {
+    for(std::size_t i = 0; i < count; ++i) {
+      OutgoingPtr outgoing(new Outgoing);
+      if (!conversion.serialize(prhs[0], i, outgoing->serialized)) {
+        outgoing->message = conversion.fromMatlab(prhs[0], i);
+        if (!outgoing->message) throw Exception("Publisher.schedule", "failed to parse message of type " + options_.datatype);
+      }
+      playback->messages.push_back(outgoing);
+    }
+  }
 
-//    m.message = message->getConstInstance();
-////    ROSMATLAB_PRINTF("Publishing on topic %s...", ros::Publisher::getTopic().c_str());
-//    ros::TopicManager::instance()->publish(ros::Publisher::getTopic(), boost::bind(&serialize, message), m);
-    ros::Publisher::publish(*message);
+  // a new schedule replaces the current playback
+  cancel();
+  {
+    boost::mutex::scoped_lock lock(playback_mutex_);
+    scheduled_ = count;
+    played_ = 0;
+    first_sent_ = last_sent_ = 0;
+    jitter_sum_ = jitter_squared_sum_ = jitter_max_ = 0;
   }
+  playing_ = true;
+  playback_thread_ = boost::thread(&Publisher::play, this, playback);
+}
+
+void Publisher::cancel()
+{
+  playing_ = false;
+  if (playback_thread_.joinable()) playback_thread_.join();
+}
+
+// playback thread, must not call into Matlab
+void Publisher::play(PlaybackPtr playback)
+{
+  bool sim_time = playback->ros_time && ros::Time::isSimTime();
+  double start = playback->absolute ? 0.0 : getClockTime(sim_time, false);
+  double now = 0;
+
+  for(std::size_t i = 0; i < playback->messages.size() && playing_; ++i) {
+    // sleep in slices, so that cancel() does not have to wait for the next message
+    double time = start + playback->times[i];
+    while(playing_ && (now = getClockTime(sim_time, playback->absolute)) < time) {
+      sleepClock(sim_time, playback->absolute, now, std::min(time, now + MAX_PLAYBACK_SLEEP));
+    }
+    if (!playing_) break;
+
+    try {
+      send(*playback->messages[i]);
+      sent_++;
+    } catch(std::exception& e) {
+      ROS_ERROR("failed to publish a message on topic %s: %s", options_.topic.c_str(), e.what());
+    }
+    playback->messages[i].reset();
+
+    double jitter = now - time;
+    boost::mutex::scoped_lock lock(playback_mutex_);
+    if (played_ == 0) first_sent_ = now;
+    last_sent_ = now;
+    played_++;
+    jitter_sum_ += jitter;
+    jitter_squared_sum_ += jitter * jitter;
+    jitter_max_ = std::max(jitter_max_, std::fabs(jitter));
+  }
+
+  playing_ = false;
+}
+
+// Called from the Matlab, publisher and playback threads. ros::Publisher::publish(serfunc, m) is private, so its
+// validity check is repeated here for serialized messages. Latched messages are kept by the publication itself.
+void Publisher::send(Outgoing& outgoing)
+{
+  if (!*this) throw Exception("Publisher.publish", "publisher for topic " + options_.topic + " is not advertised");
+  if (outgoing.message) {
+    ros::Publisher::publish(*outgoing.message);
+    return;
+  }
+  ros::TopicManager::instance()->publish(resolved_topic_, outgoing.serializer, outgoing.serialized);
+}
+
+// sends a message on the Matlab thread or queues it for the publisher thread in asynchronous mode
+void Publisher::dispatch(Outgoing& outgoing, const OutgoingPtr& queued)
+{
+  if (queued) {
+    enqueue(queued);
+    return;
+  }
+  send(outgoing);
+  sent_++;
+  outgoing.clear();
+}
+
+// called from the Matlab thread, new messages are only allocated until the pool has filled up
+Publisher::OutgoingPtr Publisher::acquire()
+{
+  OutgoingPtr outgoing;
+  outgoing.swap(spare_);
+  if (!outgoing && !recycled_->pop(outgoing)) outgoing.reset(new Outgoing);
+  return outgoing;
+}
+
+// called from the Matlab thread in asynchronous mode
+void Publisher::enqueue(const OutgoingPtr& outgoing)
+{
+  if (!queue_->push(outgoing)) {
+    if (!blocking_) {
+      dropped_++;
+      outgoing->clear();
+      spare_ = outgoing;
+      return;
+    }
+
+    // back-pressure: wait until the publisher thread has sent a message
+    ros::WallTime start = ros::WallTime::now();
+    while(!queue_->push(outgoing)) queue_->waitForSpace();
+    blocked_++;
+    blocked_time_ += (ros::WallTime::now() - start).toSec();
+  }
+
+  max_queued_ = std::max(max_queued_, queue_->size());
+}
+
+// publisher thread, must not call into Matlab
+void Publisher::run()
+{
+  // queued messages are sent before the thread stops
+  OutgoingPtr outgoing;
+  do {
+    while(queue_->pop(outgoing)) {
+      try {
+        send(*outgoing);
+        sent_++;
+      } catch(std::exception& e) {
+        ROS_ERROR("failed to publish a message on topic %s: %s", options_.topic.c_str(), e.what());
+      }
+      outgoing->clear();
+      recycled_->push(outgoing);
+      outgoing.reset();
+    }
+  } while(queue_->waitForData());
+}
+
+void Publisher::stop()
+{
+  if (!thread_.joinable()) return;
+  queue_->close();
+  thread_.join();
 }
 
 mxArray *Publisher::getTopic() const
@@ -147,4 +464,32 @@ mxArray *Publisher::isLatched() const
   return mxCreateLogicalScalar(*this ? ros::Publisher::isLatched() : false);
 }
 
+mxArray *Publisher::getStatistics() const
+{
+  static const char *fieldnames[] = { "Async", "Published", "Dropped", "Queued", "MaxQueued", "Capacity", "Blocked", "BlockedTime",
+                                      "Playing", "Scheduled", "Played", "Rate", "JitterMean", "JitterStd", "JitterMax" };
+  mxArray *result = mxCreateStructMatrix(1, 1, sizeof(fieldnames)/sizeof(*fieldnames), fieldnames);
+  mxSetField(result, 0, "Async", mxCreateLogicalScalar(async_));
+  mxSetField(result, 0, "Published", mxCreateDoubleScalar(sent_.load()));
+  mxSetField(result, 0, "Dropped", mxCreateDoubleScalar(dropped_.load()));
+  mxSetField(result, 0, "Queued", mxCreateDoubleScalar(queue_ ? queue_->size() : 0));
+  mxSetField(result, 0, "MaxQueued", mxCreateDoubleScalar(max_queued_));
+  mxSetField(result, 0, "Capacity", mxCreateDoubleScalar(async_ ? queue_size_ : 0));
+  mxSetField(result, 0, "Blocked", mxCreateDoubleScalar(blocked_));
+  mxSetField(result, 0, "BlockedTime", mxCreateDoubleScalar(blocked_time_));
+
+  // achieved rate and deviation of the send times from the schedule, in seconds
+  boost::mutex::scoped_lock lock(playback_mutex_);
+  double mean = played_ ? jitter_sum_ / played_ : 0;
+  double variance = played_ ? std::max(jitter_squared_sum_ / played_ - mean * mean, 0.0) : 0;
+  mxSetField(result, 0, "Playing", mxCreateLogicalScalar(playing_));
+  mxSetField(result, 0, "Scheduled", mxCreateDoubleScalar(scheduled_));
+  mxSetField(result, 0, "Played", mxCreateDoubleScalar(played_));
+  mxSetField(result, 0, "Rate", mxCreateDoubleScalar((played_ > 1 && last_sent_ > first_sent_) ? (played_ - 1) / (last_sent_ - first_sent_) : 0));
+  mxSetField(result, 0, "JitterMean", mxCreateDoubleScalar(mean));
+  mxSetField(result, 0, "JitterStd", mxCreateDoubleScalar(std::sqrt(variance)));
+  mxSetField(result, 0, "JitterMax", mxCreateDoubleScalar(jitter_max_));
+  return result;
+}
+
 } // namespace rosmatlab
@@ -0,0 +1,77 @@
+//=================================================================================================
+// Copyright (c) 2013, Johannes Meyer, TU Darmstadt
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of the Flight Systems and Automatic Control group,
+//       TU Darmstadt, nor the names of its contributors may be used to
+//       endorse or promote products derived from this software without
+//       specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//=================================================================================================
+
+#include <rosmatlab/serialized_buffers.h>
+#include <cstring>
+
+namespace rosmatlab {
+
+namespace {
+  // keeps an encoded buffer alive as long as a serialized message refers to it
+  struct BufferHolder {
+    BufferHolder(const boost::shared_ptr<std::vector<uint8_t> >& buffer) : buffer(buffer) {}
+    void operator()(uint8_t *) { buffer.reset(); }
+    boost::shared_ptr<std::vector<uint8_t> > buffer;
+  };
+}
+
+bool SerializedBuffers::encode(const Decoder& encoder, const mxArray *source, std::size_t index, ros::SerializedMessage& m)
+{
+  Buffer *buffer = 0;
+  Buffer unpooled;
+  for(std::vector<Buffer>::iterator it = buffers_.begin(); !buffer && it != buffers_.end(); ++it) {
+    if (!it->array || it->array.unique()) buffer = &(*it);
+  }
+  if (!buffer) {
+    if (buffers_.size() < MAX_BUFFERS) {
+      buffers_.push_back(Buffer());
+      buffer = &buffers_.back();
+    } else {
+      buffer = &unpooled;
+    }
+    buffer->data.reset(new std::vector<uint8_t>);
+  }
+
+  // length prefix followed by the message
+  std::vector<uint8_t>& data = *buffer->data;
+  data.reserve(sizeof(uint32_t) + encoder.getEncodedLength(source, index));
+  data.resize(sizeof(uint32_t));
+  if (!encoder.encode(source, index, data)) return false;
+
+  uint32_t length = data.size() - sizeof(uint32_t);
+  std::memcpy(data.data(), &length, sizeof(length));
+
+  // the array shares the ownership of the vector and is only recreated if the vector has grown
+  if (buffer->array.get() != data.data()) buffer->array = boost::shared_array<uint8_t>(data.data(), BufferHolder(buffer->data));
+  m.buf = buffer->array;
+  m.num_bytes = data.size();
+  m.message_start = m.buf.get() + sizeof(uint32_t);
+  return true;
+}
+
+} // namespace rosmatlab
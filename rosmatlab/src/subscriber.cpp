@@ -35,10 +35,16 @@
 
 #include <introspection/message.h>
 
+#include <boost/algorithm/string.hpp>
+#include <algorithm>
+#include <limits>
+#include <cstring>
+
 namespace rosmatlab {
 
 template <> const char *Object<Subscriber>::class_name_ = "ros.Subscriber";
 static const ros::WallDuration DEFAULT_TIMEOUT(1e-3);
+static const std::size_t DEFAULT_BUFFER_SIZE = 1;
 
 class SubscriptionCallbackHelper : public ros::SubscriptionCallbackHelper
 {
@@ -49,7 +55,7 @@ public:
 
   VoidConstPtr deserialize(const ros::SubscriptionCallbackHelperDeserializeParams&);
   void call(ros::SubscriptionCallbackHelperCallParams& params);
-  const std::type_info& getTypeInfo() { return subscriber_->introspection_->getTypeId(); }
+  const std::type_info& getTypeInfo() { return subscriber_->lazy_ ? typeid(ros::SerializedMessage) : subscriber_->introspection_->getTypeId(); }
   bool isConst() { return false; }
 
 private:
@@ -58,16 +64,20 @@ private:
 
 Subscriber::Subscriber()
   : Object<Subscriber>(this)
+  , buffer_(new Buffer(DEFAULT_BUFFER_SIZE)), buffer_size_(DEFAULT_BUFFER_SIZE)
+  , received_(0), dropped_(0), dropped_reported_(0)
 {
   timeout_ = DEFAULT_TIMEOUT;
-  node_handle_.setCallbackQueue(&callback_queue_);
+  lazy_ = false;
 }
 
 Subscriber::Subscriber(int nrhs, const mxArray *prhs[])
   : Object<Subscriber>(this)
+  , buffer_(new Buffer(DEFAULT_BUFFER_SIZE)), buffer_size_(DEFAULT_BUFFER_SIZE)
+  , received_(0), dropped_(0), dropped_reported_(0)
 {
   timeout_ = DEFAULT_TIMEOUT;
-  node_handle_.setCallbackQueue(&callback_queue_);
+  lazy_ = false;
 
   if (nrhs > 0) subscribe(nrhs, prhs);
 }
@@ -81,8 +91,21 @@ mxArray *Subscriber::subscribe(int nrhs, const mxArray *prhs[]) {
     throw ArgumentException("Subscriber.subscribe", 2);
   }
 
+  // make sure that no callback is running while the buffer is replaced
+  shutdown();
+
   options_ = ros::SubscribeOptions();
+  std::size_t buffer_size = 0;
+  bool lazy = false;
   for(int i = 0; i < nrhs; i++) {
+    // key/value options follow the positional arguments
+    if (i >= 2 && Options::isString(prhs[i])) {
+      Options options(nrhs - i, prhs + i, true);
+      lazy = options.getBool("lazy");
+      options.throwOnUnused();
+      break;
+    }
+
     switch(i) {
       case 0:
         if (!Options::isString(prhs[i])) throw Exception("Subscriber.subscribe", "need a topic as 1st argument");
@@ -99,6 +122,11 @@ mxArray *Subscriber::subscribe(int nrhs, const mxArray *prhs[]) {
         options_.queue_size = Options::getDoubleScalar(prhs[i]);
         break;
 
+      case 3:
+        if (!Options::isDoubleScalar(prhs[i]) || Options::getDoubleScalar(prhs[i]) < 1) throw Exception("Subscriber.subscribe", "need a positive buffer size as 4th argument (optional)");
+        buffer_size = Options::getDoubleScalar(prhs[i]);
+        break;
+
       default:
         throw ArgumentException("Subscriber.subscribe", "too many arguments");
     }
@@ -107,8 +135,17 @@ mxArray *Subscriber::subscribe(int nrhs, const mxArray *prhs[]) {
   introspection_ = cpp_introspection::messageByDataType(options_.datatype);
   if (!introspection_) throw Exception("Subscriber.subscribe", "unknown datatype '" + options_.datatype + "'");
   options_.md5sum = introspection_->getMD5Sum();
+
+  lazy_ = lazy;
   options_.helper.reset(new SubscriptionCallbackHelper(this));
 
+  // the buffer holds as many messages as the subscriber queue unless specified otherwise
+  if (buffer_size == 0) buffer_size = std::max<std::size_t>(options_.queue_size, DEFAULT_BUFFER_SIZE);
+  buffer_.reset(new Buffer(buffer_size));
+  buffer_size_ = buffer_size;
+  last_event_.reset();
+  received_ = dropped_ = dropped_reported_ = 0;
+
   *this = node_handle_.subscribe(options_);
   return mxCreateLogicalScalar(*this);
 }
@@ -117,19 +154,73 @@ mxArray *Subscriber::poll(int nlhs, mxArray *plhs[], int nrhs, const mxArray *pr
 {
   ros::WallDuration timeout = timeout_;
   if (nrhs && mxIsDouble(*prhs) && mxGetPr(*prhs)) { timeout.fromSec(*mxGetPr(*prhs++)); nrhs--; }
-  callback_queue_.callOne(timeout);
+
+  // batch mode: poll([timeout,] 'all') or poll(timeout, maxCount)
+  bool batch = false;
+  std::size_t max_count = 1;
+  if (nrhs > 0) {
+    if (Options::isString(*prhs) && boost::algorithm::iequals(Options::getString(*prhs), "all")) {
+      max_count = std::numeric_limits<std::size_t>::max();
+    } else if (Options::isDoubleScalar(*prhs) && Options::getDoubleScalar(*prhs) >= 0) {
+      max_count = Options::getDoubleScalar(*prhs);
+    } else if (Options::isIntegerScalar(*prhs) && Options::getIntegerScalar(*prhs) >= 0) {
+      max_count = Options::getIntegerScalar(*prhs);
+    } else {
+      throw Exception("Subscriber.poll", "need 'all' or a maximum message count as argument");
+    }
+    batch = true;
+    prhs++; nrhs--;
+  }
+
+  // only wait if the buffer is empty
+  if (buffer_->empty()) wait(timeout);
+
+  if (dropped_ > dropped_reported_) {
+    ROSMATLAB_WARN("missed %u %s messages on topic %s, polling is too slow or the buffer is too small...", static_cast<unsigned int>(dropped_ - dropped_reported_), options_.datatype.c_str(), options_.topic.c_str());
+    dropped_reported_ = dropped_;
+  }
 
   last_event_.reset();
-  if (!new_event_) {
+  if (buffer_->empty()) {
     plhs[0] = mxCreateStructMatrix(0,0,0,0);
     return plhs[0];
   }
 
-  plhs[0] = Conversion(introspect(new_event_->getConstMessage())).toMatlab();
-  last_event_.swap(new_event_);
+  if (!batch) {
+    buffer_->pop(last_event_);
+    Conversion conversion(introspection_);
+    plhs[0] = convert(conversion, last_event_);
+
+    if (nlhs > 1) plhs[1] = getConnectionHeader();
+    if (nlhs > 2) plhs[2] = getReceiptTime();
+    return plhs[0];
+  }
+
+  // convert all messages into a single preallocated array, large payloads are filled in parallel
+  // after all messages have been converted, so the events have to be kept until then
+  std::size_t count = std::min(buffer_->size(), max_count);
+  Decoder::Jobs jobs;
+  Conversion conversion(introspection_);
+  conversion.setJobs(&jobs);
+  std::vector<MessageEventPtr> events(count);
+  mxArray *connection_headers = (nlhs > 1) ? mxCreateCellMatrix(1, count) : 0;
+  mxArray *receipt_times = (nlhs > 2) ? mxCreateDoubleMatrix(1, count, mxREAL) : 0;
+
+  plhs[0] = 0;
+  for(std::size_t i = 0; i < count; ++i) {
+    buffer_->pop(last_event_);
+    events[i] = last_event_;
+    plhs[0] = convert(conversion, last_event_, plhs[0], i, count);
+
+    if (connection_headers) mxSetCell(connection_headers, i, getConnectionHeader());
+    if (receipt_times) mxGetPr(receipt_times)[i] = last_event_->getReceiptTime().toSec();
+  }
+  jobs.finish();
 
-  if (nlhs > 1) plhs[1] = getConnectionHeader();
-  if (nlhs > 2) plhs[2] = getReceiptTime();
+  // a maximum count of 0 returns an empty array like an empty buffer
+  if (!plhs[0]) plhs[0] = mxCreateStructMatrix(0, 0, 0, 0);
+  if (nlhs > 1) plhs[1] = connection_headers;
+  if (nlhs > 2) plhs[2] = receipt_times;
   return plhs[0];
 }
 
@@ -169,25 +260,57 @@ mxArray *Subscriber::getNumPublishers() const
   return mxCreateDoubleScalar(ros::Subscriber::getNumPublishers());
 }
 
-MessagePtr Subscriber::introspect(const VoidConstPtr& msg) {
-  if (!introspection_ || !msg) return MessagePtr();
-  return introspection_->introspect(msg.get());
+mxArray *Subscriber::getStatistics() const
+{
+  static const char *fieldnames[] = { "Received", "Dropped", "Buffered", "Capacity" };
+  mxArray *result = mxCreateStructMatrix(1, 1, sizeof(fieldnames)/sizeof(*fieldnames), fieldnames);
+  mxSetField(result, 0, "Received", mxCreateDoubleScalar(received_.load()));
+  mxSetField(result, 0, "Dropped", mxCreateDoubleScalar(dropped_.load()));
+  mxSetField(result, 0, "Buffered", mxCreateDoubleScalar(buffer_->size()));
+  mxSetField(result, 0, "Capacity", mxCreateDoubleScalar(buffer_size_));
+  return result;
 }
 
-void Subscriber::callback(const MessageEvent& event)
+mxArray *Subscriber::convert(Conversion& conversion, const MessageEventPtr& event, mxArray *target, std::size_t index, std::size_t size)
 {
-  if (new_event_) {
-    ROSMATLAB_WARN("missed a %s message on topic %s, polling is too slow...", options_.datatype.c_str(), options_.topic.c_str());
-    return;
+  // messages received in lazy mode are decoded directly from the serialized bytes
+  if (lazy_) {
+    const ros::SerializedMessage& serialized = *boost::static_pointer_cast<const ros::SerializedMessage>(event->getConstMessage());
+    ros::serialization::IStream stream(serialized.message_start, serialized.num_bytes - (serialized.message_start - serialized.buf.get()));
+    return conversion.toMatlab(stream, target, index, size);
   }
-  new_event_.reset(new MessageEvent(event));
+
+  return conversion.setMessage(introspection_->introspect(event->getConstMessage().get())).toMatlab(target, index, size);
+}
+
+// called from the spinner thread, must not call into Matlab
+void Subscriber::callback(const MessageEvent& event)
+{
+  received_++;
+
+  // push() wakes up the Matlab thread if it is waiting in poll()
+  if (buffer_->full() || !buffer_->push(MessageEventPtr(new MessageEvent(event)))) dropped_++;
+}
+
+bool Subscriber::wait(const ros::WallDuration& timeout)
+{
+  boost::system_time deadline = boost::get_system_time() + boost::posix_time::microseconds(timeout.toNSec() / 1000);
+  return buffer_->waitForData(deadline);
 }
 
 VoidConstPtr SubscriptionCallbackHelper::deserialize(const ros::SubscriptionCallbackHelperDeserializeParams& params)
 {
+  // In lazy mode only the serialized bytes are kept. They have to be copied: roscpp only passes a pointer into its
+  // receive buffer and releases that buffer after this call. The copy is still cheaper than deserialization.
+  if (subscriber_->lazy_) {
+    boost::shared_ptr<ros::SerializedMessage> serialized(new ros::SerializedMessage(boost::shared_array<uint8_t>(new uint8_t[params.length]), params.length));
+    std::memcpy(serialized->buf.get(), params.buffer, params.length);
+    return serialized;
+  }
+
   ros::serialization::IStream stream(params.buffer, params.length);
   VoidPtr msg = subscriber_->introspection_->deserialize(stream);
-  if (!msg) ROSMATLAB_WARN("deserialization of a message of type %s failed", subscriber_->options_.datatype.c_str());
+  if (!msg) ROS_WARN("deserialization of a message of type %s failed", subscriber_->options_.datatype.c_str());
 
   return VoidConstPtr(msg);
 }
@@ -0,0 +1,231 @@
+//=================================================================================================
+// Copyright (c) 2013, Johannes Meyer, TU Darmstadt
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of the Flight Systems and Automatic Control group,
+//       TU Darmstadt, nor the names of its contributors may be used to
+//       endorse or promote products derived from this software without
+//       specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//=================================================================================================
+
+#include <rosmatlab/transpose.h>
+#include <rosmatlab/exception.h>
+
+#include <boost/lexical_cast.hpp>
+
+#include <algorithm>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64)
+  #define ROSMATLAB_HAVE_SSE2
+  #include <emmintrin.h>
+#endif
+
+namespace rosmatlab {
+
+namespace {
+  // 32x32 blocks of 8 byte elements fit into 16 KiB of L1 cache for both source and target
+  const std::size_t BLOCK = 32;
+
+  template <typename T> static inline T load(const uint8_t *source) {
+    T value;
+    std::memcpy(&value, source, sizeof(T));
+    return value;
+  }
+
+  template <typename T> static inline void store(uint8_t *target, T value) {
+    std::memcpy(target, &value, sizeof(T));
+  }
+
+  template <typename Source, typename Target>
+  static void transposeBlock(uint8_t *target, std::size_t target_row, std::size_t target_column,
+                             const uint8_t *source, std::size_t source_row, std::size_t source_column,
+                             std::size_t r0, std::size_t r1, std::size_t c0, std::size_t c1)
+  {
+    for(std::size_t c = c0; c < c1; ++c) {
+      uint8_t *t = target + c * target_column;
+      const uint8_t *s = source + c * source_column;
+      for(std::size_t r = r0; r < r1; ++r) {
+        store<Target>(t + r * target_row, static_cast<Target>(load<Source>(s + r * source_row)));
+      }
+    }
+  }
+
+  // SSE2 tiles transpose SIZE lines of SIZE contiguous elements
+  template <typename T> struct Tile {
+    enum { SIZE = 0 };
+    static void transpose(uint8_t *, std::size_t, const uint8_t *, std::size_t) {}
+  };
+
+#ifdef ROSMATLAB_HAVE_SSE2
+  template <> struct Tile<uint8_t> {
+    enum { SIZE = 8 };
+    static void transpose(uint8_t *target, std::size_t target_stride, const uint8_t *source, std::size_t source_stride) {
+      __m128i a0 = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(source));
+      __m128i a1 = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(source + source_stride));
+      __m128i a2 = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(source + 2 * source_stride));
+      __m128i a3 = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(source + 3 * source_stride));
+      __m128i a4 = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(source + 4 * source_stride));
+      __m128i a5 = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(source + 5 * source_stride));
+      __m128i a6 = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(source + 6 * source_stride));
+      __m128i a7 = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(source + 7 * source_stride));
+
+      __m128i b0 = _mm_unpacklo_epi8(a0, a1);
+      __m128i b1 = _mm_unpacklo_epi8(a2, a3);
+      __m128i b2 = _mm_unpacklo_epi8(a4, a5);
+      __m128i b3 = _mm_unpacklo_epi8(a6, a7);
+
+      __m128i c0 = _mm_unpacklo_epi16(b0, b1);
+      __m128i c1 = _mm_unpackhi_epi16(b0, b1);
+      __m128i c2 = _mm_unpacklo_epi16(b2, b3);
+      __m128i c3 = _mm_unpackhi_epi16(b2, b3);
+
+      // each register holds two transposed lines
+      __m128i d[4] = { _mm_unpacklo_epi32(c0, c2), _mm_unpackhi_epi32(c0, c2), _mm_unpacklo_epi32(c1, c3), _mm_unpackhi_epi32(c1, c3) };
+      for(int i = 0; i < 4; ++i) {
+        _mm_storel_epi64(reinterpret_cast<__m128i *>(target + 2 * i * target_stride), d[i]);
+        _mm_storel_epi64(reinterpret_cast<__m128i *>(target + (2 * i + 1) * target_stride), _mm_srli_si128(d[i], 8));
+      }
+    }
+  };
+
+  template <> struct Tile<uint32_t> {
+    enum { SIZE = 4 };
+    static void transpose(uint8_t *target, std::size_t target_stride, const uint8_t *source, std::size_t source_stride) {
+      __m128 a0 = _mm_loadu_ps(reinterpret_cast<const float *>(source));
+      __m128 a1 = _mm_loadu_ps(reinterpret_cast<const float *>(source + source_stride));
+      __m128 a2 = _mm_loadu_ps(reinterpret_cast<const float *>(source + 2 * source_stride));
+      __m128 a3 = _mm_loadu_ps(reinterpret_cast<const float *>(source + 3 * source_stride));
+      _MM_TRANSPOSE4_PS(a0, a1, a2, a3);
+      _mm_storeu_ps(reinterpret_cast<float *>(target), a0);
+      _mm_storeu_ps(reinterpret_cast<float *>(target + target_stride), a1);
+      _mm_storeu_ps(reinterpret_cast<float *>(target + 2 * target_stride), a2);
+      _mm_storeu_ps(reinterpret_cast<float *>(target + 3 * target_stride), a3);
+    }
+  };
+#endif // ROSMATLAB_HAVE_SSE2
+
+  // copy elements of the same size, using tiles where one side is contiguous along rows and the other along columns
+  template <typename T>
+  static void transposeCopy(uint8_t *target, std::size_t target_row, std::size_t target_column,
+                            const uint8_t *source, std::size_t source_row, std::size_t source_column,
+                            std::size_t rows, std::size_t columns)
+  {
+    const std::size_t size = Tile<T>::SIZE;
+    bool forward = size && source_column == sizeof(T) && target_row == sizeof(T);
+    bool backward = size && source_row == sizeof(T) && target_column == sizeof(T);
+
+    for(std::size_t r0 = 0; r0 < rows; r0 += BLOCK) {
+      std::size_t r1 = std::min(r0 + BLOCK, rows);
+      for(std::size_t c0 = 0; c0 < columns; c0 += BLOCK) {
+        std::size_t c1 = std::min(c0 + BLOCK, columns);
+        if (!forward && !backward) {
+          transposeBlock<T,T>(target, target_row, target_column, source, source_row, source_column, r0, r1, c0, c1);
+          continue;
+        }
+
+        std::size_t rt = r0 + (r1 - r0) / size * size;
+        std::size_t ct = c0 + (c1 - c0) / size * size;
+        for(std::size_t r = r0; r < rt; r += size) {
+          for(std::size_t c = c0; c < ct; c += size) {
+            uint8_t *t = target + r * target_row + c * target_column;
+            const uint8_t *s = source + r * source_row + c * source_column;
+            if (forward) Tile<T>::transpose(t, target_column, s, source_row);
+            else         Tile<T>::transpose(t, target_row, s, source_column);
+          }
+        }
+
+        // remainders
+        transposeBlock<T,T>(target, target_row, target_column, source, source_row, source_column, r0, r1, ct, c1);
+        transposeBlock<T,T>(target, target_row, target_column, source, source_row, source_column, rt, r1, c0, ct);
+      }
+    }
+  }
+
+  template <typename Source, typename Target>
+  static void transposeConvert(uint8_t *target, std::size_t target_row, std::size_t target_column,
+                               const uint8_t *source, std::size_t source_row, std::size_t source_column,
+                               std::size_t rows, std::size_t columns)
+  {
+    for(std::size_t r0 = 0; r0 < rows; r0 += BLOCK) {
+      std::size_t r1 = std::min(r0 + BLOCK, rows);
+      for(std::size_t c0 = 0; c0 < columns; c0 += BLOCK) {
+        std::size_t c1 = std::min(c0 + BLOCK, columns);
+        transposeBlock<Source,Target>(target, target_row, target_column, source, source_row, source_column, r0, r1, c0, c1);
+      }
+    }
+  }
+}
+
+void transpose(uint8_t *target, std::size_t target_row, std::size_t target_column,
+               const uint8_t *source, std::size_t source_row, std::size_t source_column,
+               std::size_t rows, std::size_t columns, std::size_t element_size)
+{
+  switch(element_size) {
+    case 1: transposeCopy<uint8_t>(target, target_row, target_column, source, source_row, source_column, rows, columns); break;
+    case 2: transposeCopy<uint16_t>(target, target_row, target_column, source, source_row, source_column, rows, columns); break;
+    case 4: transposeCopy<uint32_t>(target, target_row, target_column, source, source_row, source_column, rows, columns); break;
+    case 8: transposeCopy<uint64_t>(target, target_row, target_column, source, source_row, source_column, rows, columns); break;
+    default: throw Exception("Cannot transpose elements of size " + boost::lexical_cast<std::string>(element_size));
+  }
+}
+
+void transposeToDouble(uint8_t *target, std::size_t target_row, std::size_t target_column,
+                       const uint8_t *source, std::size_t source_row, std::size_t source_column,
+                       std::size_t rows, std::size_t columns, Decoder::FieldType source_type)
+{
+  switch(source_type) {
+    case Decoder::BOOL:
+    case Decoder::UINT8:   transposeConvert<uint8_t,double>(target, target_row, target_column, source, source_row, source_column, rows, columns); break;
+    case Decoder::INT8:    transposeConvert<int8_t,double>(target, target_row, target_column, source, source_row, source_column, rows, columns); break;
+    case Decoder::UINT16:  transposeConvert<uint16_t,double>(target, target_row, target_column, source, source_row, source_column, rows, columns); break;
+    case Decoder::INT16:   transposeConvert<int16_t,double>(target, target_row, target_column, source, source_row, source_column, rows, columns); break;
+    case Decoder::UINT32:  transposeConvert<uint32_t,double>(target, target_row, target_column, source, source_row, source_column, rows, columns); break;
+    case Decoder::INT32:   transposeConvert<int32_t,double>(target, target_row, target_column, source, source_row, source_column, rows, columns); break;
+    case Decoder::UINT64:  transposeConvert<uint64_t,double>(target, target_row, target_column, source, source_row, source_column, rows, columns); break;
+    case Decoder::INT64:   transposeConvert<int64_t,double>(target, target_row, target_column, source, source_row, source_column, rows, columns); break;
+    case Decoder::FLOAT32: transposeConvert<float,double>(target, target_row, target_column, source, source_row, source_column, rows, columns); break;
+    case Decoder::FLOAT64: transposeCopy<uint64_t>(target, target_row, target_column, source, source_row, source_column, rows, columns); break;
+    default: throw Exception("Cannot transpose elements of this type");
+  }
+}
+
+void transposeFromDouble(uint8_t *target, std::size_t target_row, std::size_t target_column,
+                         const uint8_t *source, std::size_t source_row, std::size_t source_column,
+                         std::size_t rows, std::size_t columns, Decoder::FieldType target_type)
+{
+  switch(target_type) {
+    case Decoder::BOOL:
+    case Decoder::UINT8:   transposeConvert<double,uint8_t>(target, target_row, target_column, source, source_row, source_column, rows, columns); break;
+    case Decoder::INT8:    transposeConvert<double,int8_t>(target, target_row, target_column, source, source_row, source_column, rows, columns); break;
+    case Decoder::UINT16:  transposeConvert<double,uint16_t>(target, target_row, target_column, source, source_row, source_column, rows, columns); break;
+    case Decoder::INT16:   transposeConvert<double,int16_t>(target, target_row, target_column, source, source_row, source_column, rows, columns); break;
+    case Decoder::UINT32:  transposeConvert<double,uint32_t>(target, target_row, target_column, source, source_row, source_column, rows, columns); break;
+    case Decoder::INT32:   transposeConvert<double,int32_t>(target, target_row, target_column, source, source_row, source_column, rows, columns); break;
+    case Decoder::UINT64:  transposeConvert<double,uint64_t>(target, target_row, target_column, source, source_row, source_column, rows, columns); break;
+    case Decoder::INT64:   transposeConvert<double,int64_t>(target, target_row, target_column, source, source_row, source_column, rows, columns); break;
+    case Decoder::FLOAT32: transposeConvert<double,float>(target, target_row, target_column, source, source_row, source_column, rows, columns); break;
+    case Decoder::FLOAT64: transposeCopy<uint64_t>(target, target_row, target_column, source, source_row, source_column, rows, columns); break;
+    default: throw Exception("Cannot transpose elements of this type");
+  }
+}
+
+} // namespace rosmatlab
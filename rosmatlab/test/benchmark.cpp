@@ -0,0 +1,645 @@
+//=================================================================================================
+// Copyright (c) 2013, Johannes Meyer, TU Darmstadt
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of the Flight Systems and Automatic Control group,
+//       TU Darmstadt, nor the names of its contributors may be used to
+//       endorse or promote products derived from this software without
+//       specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//=================================================================================================
+
+// Benchmarks of the conversion paths that do not need a Matlab session or a ROS master. Run the
+// rosmatlab-benchmark target with the names of the sections to run, or without arguments for all of them.
+// Paths that were replaced and needed cpp_introspection instances are emulated with the same steps
+// (deserialize into an instance, convert each element through boost::any).
+
+#include <rosmatlab/decoder.h>
+#include <rosmatlab/conversion.h>
+#include <rosmatlab/transpose.h>
+
+#include <ros/time.h>
+#include <boost/any.hpp>
+#include <boost/thread/thread.hpp>
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+using namespace rosmatlab;
+
+namespace {
+  // time per call of f in microseconds, the best mean of five rounds of at least 0.2 seconds after one warm-up call
+  template <typename F> double measure(F& f) {
+    f();
+    double best = 0.0;
+    for(int round = 0; round < 5; ++round) {
+      std::size_t calls = 0;
+      double elapsed = 0.0;
+      ros::WallTime start = ros::WallTime::now();
+      do {
+        f();
+        ++calls;
+        elapsed = (ros::WallTime::now() - start).toSec();
+      } while(elapsed < 0.2);
+      if (round == 0 || elapsed / calls < best) best = elapsed / calls;
+    }
+    return 1e6 * best;
+  }
+
+  // prints the time of a path and its speedup over the reference path of the same section
+  void report(const char *section, const char *path, double time, double reference = 0.0) {
+    if (reference > 0.0) {
+      std::printf("%-10s %-60s %12.3f us %8.1fx\n", section, path, time, reference / time);
+    } else {
+      std::printf("%-10s %-60s %12.3f us\n", section, path, time);
+    }
+  }
+
+  template <typename T> void append(std::vector<uint8_t>& data, const T& value) {
+    const uint8_t *bytes = reinterpret_cast<const uint8_t *>(&value);
+    data.insert(data.end(), bytes, bytes + sizeof(T));
+  }
+
+  void append(std::vector<uint8_t>& data, const std::string& value) {
+    append(data, static_cast<uint32_t>(value.size()));
+    data.insert(data.end(), value.begin(), value.end());
+  }
+
+  template <typename T> T read(const uint8_t *&data) {
+    T value;
+    std::memcpy(&value, data, sizeof(T));
+    data += sizeof(T);
+    return value;
+  }
+
+  std::string readString(const uint8_t *&data) {
+    uint32_t length = read<uint32_t>(data);
+    std::string value(reinterpret_cast<const char *>(data), length);
+    data += length;
+    return value;
+  }
+
+  // the conversion of a single element in the removed field-by-field path
+  mxArray *fromAny(const boost::any& value) {
+    if (value.type() == typeid(std::string)) return mxCreateString(boost::any_cast<const std::string&>(value).c_str());
+    if (value.type() == typeid(double))   return mxCreateDoubleScalar(boost::any_cast<double>(value));
+    if (value.type() == typeid(float))    return mxCreateDoubleScalar(boost::any_cast<float>(value));
+    if (value.type() == typeid(int32_t))  return mxCreateDoubleScalar(boost::any_cast<int32_t>(value));
+    if (value.type() == typeid(uint32_t)) return mxCreateDoubleScalar(boost::any_cast<uint32_t>(value));
+    if (value.type() == typeid(uint8_t))  return mxCreateDoubleScalar(boost::any_cast<uint8_t>(value));
+    return mxCreateDoubleMatrix(0, 0, mxREAL);
+  }
+
+  template <typename T> double asDouble(const boost::any& value) {
+    return static_cast<double>(boost::any_cast<T>(value));
+  }
+
+  /*
+    decode: a small message with a header, a string, a fixed-size array and a nested message,
+    decoded from its serialized form
+  */
+  const char *SAMPLE_DEFINITION =
+      "Header header\n"
+      "string name\n"
+      "int32[3] ids\n"
+      "Point position\n"
+      "float32 ratio\n"
+      "bool valid\n"
+      "================================================================================\n"
+      "MSG: std_msgs/Header\n"
+      "uint32 seq\n"
+      "time stamp\n"
+      "string frame_id\n"
+      "================================================================================\n"
+      "MSG: test_msgs/Point\n"
+      "float64 x\n"
+      "float64 y\n"
+      "float64 z\n";
+
+  struct Sample {
+    uint32_t seq;
+    uint32_t sec, nsec;
+    std::string frame_id;
+    std::string name;
+    int32_t ids[3];
+    double x, y, z;
+    float ratio;
+    uint8_t valid;
+  };
+
+  const std::size_t SAMPLES = 1000;
+
+  std::vector<uint8_t> serializeSample(uint32_t seq) {
+    std::vector<uint8_t> data;
+    append(data, seq);
+    append(data, uint32_t(12));
+    append(data, uint32_t(500000000));
+    append(data, std::string("base_link"));
+    append(data, std::string("sample"));
+    for(int32_t i = 0; i < 3; ++i) append(data, i);
+    append(data, 1.5);
+    append(data, -2.5);
+    append(data, 1e10);
+    append(data, 0.25f);
+    append(data, uint8_t(1));
+    return data;
+  }
+
+  struct DecodeOld {
+    const std::vector<std::vector<uint8_t> > *messages;
+    void operator()() const {
+      static const char *sample_fields[] = { "header", "name", "ids", "position", "ratio", "valid" };
+      static const char *header_fields[] = { "seq", "stamp", "frame_id" };
+      static const char *point_fields[] = { "x", "y", "z" };
+
+      for(std::size_t j = 0; j < messages->size(); ++j) {
+        // deserialize into an instance
+        const uint8_t *data = (*messages)[j].data();
+        Sample sample;
+        sample.seq = read<uint32_t>(data);
+        sample.sec = read<uint32_t>(data);
+        sample.nsec = read<uint32_t>(data);
+        sample.frame_id = readString(data);
+        sample.name = readString(data);
+        for(int i = 0; i < 3; ++i) sample.ids[i] = read<int32_t>(data);
+        sample.x = read<double>(data);
+        sample.y = read<double>(data);
+        sample.z = read<double>(data);
+        sample.ratio = read<float>(data);
+        sample.valid = read<uint8_t>(data);
+
+        // convert each element through boost::any
+        mxArray *header = mxCreateStructMatrix(1, 1, 3, header_fields);
+        mxSetField(header, 0, "seq", fromAny(boost::any(sample.seq)));
+        mxSetField(header, 0, "stamp", mxCreateDoubleScalar(asDouble<uint32_t>(boost::any(sample.sec)) + 1e-9 * asDouble<uint32_t>(boost::any(sample.nsec))));
+        mxSetField(header, 0, "frame_id", fromAny(boost::any(sample.frame_id)));
+
+        mxArray *ids = mxCreateDoubleMatrix(1, 3, mxREAL);
+        for(int i = 0; i < 3; ++i) mxGetPr(ids)[i] = asDouble<int32_t>(boost::any(sample.ids[i]));
+
+        mxArray *position = mxCreateStructMatrix(1, 1, 3, point_fields);
+        mxSetField(position, 0, "x", fromAny(boost::any(sample.x)));
+        mxSetField(position, 0, "y", fromAny(boost::any(sample.y)));
+        mxSetField(position, 0, "z", fromAny(boost::any(sample.z)));
+
+        mxArray *message = mxCreateStructMatrix(1, 1, 6, sample_fields);
+        mxSetField(message, 0, "header", header);
+        mxSetField(message, 0, "name", fromAny(boost::any(sample.name)));
+        mxSetField(message, 0, "ids", ids);
+        mxSetField(message, 0, "position", position);
+        mxSetField(message, 0, "ratio", fromAny(boost::any(sample.ratio)));
+        mxSetField(message, 0, "valid", fromAny(boost::any(sample.valid)));
+        mxDestroyArray(message);
+      }
+    }
+  };
+
+  struct DecodeNew {
+    const std::vector<std::vector<uint8_t> > *messages;
+    const Decoder *decoder;
+    const Decoder::Plan *plan;
+    void operator()() const {
+      for(std::size_t j = 0; j < messages->size(); ++j) {
+        ros::serialization::IStream stream(const_cast<uint8_t *>((*messages)[j].data()), (*messages)[j].size());
+        mxDestroyArray(decoder->decode(stream, *plan));
+      }
+    }
+  };
+
+  void benchmarkDecode() {
+    DecoderConstPtr decoder = Decoder::forDefinition("test_msgs/Sample", SAMPLE_DEFINITION);
+    ConversionOptions::Snapshot options = ConversionOptions().snapshot();
+    options.type = ConversionOptions::MATLAB_STRUCT;
+    Decoder::PlanConstPtr plan = decoder->compile(options);
+
+    std::vector<std::vector<uint8_t> > messages;
+    for(std::size_t j = 0; j < SAMPLES; ++j) messages.push_back(serializeSample(j));
+
+    DecodeOld old_path = { &messages };
+    DecodeNew new_path = { &messages, decoder.get(), plan.get() };
+    double reference = measure(old_path) / SAMPLES;
+    report("decode", "instance + boost::any per field (emulated), per message", reference);
+    report("decode", "Decoder::decode, per message", measure(new_path) / SAMPLES, reference);
+  }
+
+  /*
+    arrays: the primitive data arrays of an Image, a PointCloud2 and a float32 depth image, converted from
+    the typed instance of a static converter
+  */
+  struct ArrayOld {
+    const std::vector<uint8_t> *data;
+    Decoder::FieldType type;
+    void operator()() const {
+      std::size_t size = Decoder::getSize(type);
+      std::size_t count = data->size() / size;
+      mxArray *array = mxCreateDoubleMatrix(count, 1, mxREAL);
+      double *x = mxGetPr(array);
+      for(std::size_t i = 0; i < count; ++i) {
+        boost::any value;
+        if (type == Decoder::UINT8) value = (*data)[i];
+        else value = reinterpret_cast<const float *>(data->data())[i];
+        x[i] = (type == Decoder::UINT8) ? asDouble<uint8_t>(value) : asDouble<float>(value);
+      }
+      mxDestroyArray(array);
+    }
+  };
+
+  struct ArrayNew {
+    const std::vector<uint8_t> *data;
+    const Decoder *decoder;
+    const Decoder::Plan *plan;
+    void operator()() const {
+      std::size_t count = data->size() / Decoder::getSize(decoder->getFields()[0].type);
+      mxDestroyArray(decoder->decodeArray(*plan, 0, 0, 0, data->data(), count));
+    }
+  };
+
+  void benchmarkArray(const char *name, const char *definition, std::size_t length) {
+    DecoderConstPtr decoder = Decoder::forDefinition("test_msgs/Payload", definition);
+    std::vector<uint8_t> data(length);
+    for(std::size_t i = 0; i < data.size(); ++i) data[i] = i * 7;
+
+    ConversionOptions::Snapshot options = ConversionOptions().snapshot();
+    options.type = ConversionOptions::MATLAB_STRUCT;
+    options.numeric = ConversionOptions::NUMERIC_DOUBLE;
+    Decoder::PlanConstPtr as_double = decoder->compile(options);
+    options.numeric = ConversionOptions::NUMERIC_NATIVE;
+    Decoder::PlanConstPtr native = decoder->compile(options);
+
+    ArrayOld old_path = { &data, decoder->getFields()[0].type };
+    ArrayNew double_path = { &data, decoder.get(), as_double.get() };
+    ArrayNew native_path = { &data, decoder.get(), native.get() };
+    double reference = measure(old_path);
+    std::string prefix(name);
+    report("arrays", (prefix + ", boost::any per element (emulated)").c_str(), reference);
+    report("arrays", (prefix + ", widened to double").c_str(), measure(double_path), reference);
+    report("arrays", (prefix + ", native class").c_str(), measure(native_path), reference);
+  }
+
+  void benchmarkArrays() {
+    benchmarkArray("Image 640x480 rgb8", "uint8[] data\n", 640 * 480 * 3);
+    benchmarkArray("PointCloud2 640x480x32 bytes", "uint8[] data\n", 640 * 480 * 32);
+    benchmarkArray("depth 640x480 float32", "float32[] data\n", 640 * 480 * sizeof(float));
+  }
+
+  /*
+    jobs: a batch of float32 depth images converted to double, either copied immediately on the calling thread or
+    allocated first and filled by the jobs on one worker per core
+  */
+  const std::size_t BATCH = 16;
+
+  struct BatchFill {
+    const std::vector<uint8_t> *data;
+    const Decoder *decoder;
+    const Decoder::Plan *plan;
+    bool parallel;
+    void operator()() const {
+      Decoder::Jobs jobs;
+      std::vector<mxArray *> arrays(BATCH);
+      std::size_t count = data->size() / sizeof(float);
+      for(std::size_t j = 0; j < BATCH; ++j) arrays[j] = decoder->decodeArray(*plan, 0, 0, 0, data->data(), count, parallel ? &jobs : 0);
+      jobs.finish();
+      for(std::size_t j = 0; j < BATCH; ++j) mxDestroyArray(arrays[j]);
+    }
+  };
+
+  void benchmarkJobs() {
+    DecoderConstPtr decoder = Decoder::forDefinition("test_msgs/Payload", "float32[] data\n");
+    std::vector<uint8_t> data(640 * 480 * sizeof(float));
+    for(std::size_t i = 0; i < data.size(); ++i) data[i] = i * 7;
+
+    ConversionOptions::Snapshot options = ConversionOptions().snapshot();
+    options.type = ConversionOptions::MATLAB_STRUCT;
+    options.numeric = ConversionOptions::NUMERIC_DOUBLE;
+    Decoder::PlanConstPtr plan = decoder->compile(options);
+
+    BatchFill serial = { &data, decoder.get(), plan.get(), false };
+    BatchFill parallel = { &data, decoder.get(), plan.get(), true };
+    double reference = measure(serial);
+    std::printf("%-10s %u cores\n", "jobs", boost::thread::hardware_concurrency());
+    report("jobs", "16 depth images to double, filled while decoding", reference);
+    report("jobs", "16 depth images to double, filled by the jobs", measure(parallel), reference);
+  }
+
+  /*
+    nested: a MarkerArray with 1000 markers, decoded in one pass into a struct array or element by element with
+    a new child conversion per marker
+  */
+  const char *MARKER_ARRAY_DEFINITION =
+      "Marker[] markers\n"
+      "================================================================================\n"
+      "MSG: visualization_msgs/Marker\n"
+      "Header header\n"
+      "string ns\n"
+      "int32 id\n"
+      "int32 type\n"
+      "int32 action\n"
+      "geometry_msgs/Pose pose\n"
+      "geometry_msgs/Vector3 scale\n"
+      "std_msgs/ColorRGBA color\n"
+      "duration lifetime\n"
+      "bool frame_locked\n"
+      "geometry_msgs/Point[] points\n"
+      "std_msgs/ColorRGBA[] colors\n"
+      "string text\n"
+      "string mesh_resource\n"
+      "bool mesh_use_embedded_materials\n"
+      "================================================================================\n"
+      "MSG: std_msgs/Header\n"
+      "uint32 seq\n"
+      "time stamp\n"
+      "string frame_id\n"
+      "================================================================================\n"
+      "MSG: geometry_msgs/Pose\n"
+      "Point position\n"
+      "Quaternion orientation\n"
+      "================================================================================\n"
+      "MSG: geometry_msgs/Point\n"
+      "float64 x\n"
+      "float64 y\n"
+      "float64 z\n"
+      "================================================================================\n"
+      "MSG: geometry_msgs/Quaternion\n"
+      "float64 x\n"
+      "float64 y\n"
+      "float64 z\n"
+      "float64 w\n"
+      "================================================================================\n"
+      "MSG: geometry_msgs/Vector3\n"
+      "float64 x\n"
+      "float64 y\n"
+      "float64 z\n"
+      "================================================================================\n"
+      "MSG: std_msgs/ColorRGBA\n"
+      "float32 r\n"
+      "float32 g\n"
+      "float32 b\n"
+      "float32 a\n";
+
+  const std::size_t MARKERS = 1000;
+
+  void serializeMarker(std::vector<uint8_t>& data, uint32_t id) {
+    append(data, id);
+    append(data, uint32_t(12));
+    append(data, uint32_t(0));
+    append(data, std::string("map"));
+    append(data, std::string("markers"));
+    append(data, int32_t(id));
+    append(data, int32_t(1));
+    append(data, int32_t(0));
+    for(int i = 0; i < 3 + 4 + 3; ++i) append(data, 0.5 * i);
+    for(int i = 0; i < 4; ++i) append(data, 1.0f);
+    append(data, int32_t(0));
+    append(data, int32_t(0));
+    append(data, uint8_t(0));
+    append(data, uint32_t(0));
+    append(data, uint32_t(0));
+    append(data, std::string());
+    append(data, std::string());
+    append(data, uint8_t(0));
+  }
+
+  struct NestedOld {
+    const std::vector<uint8_t> *data;
+    const Decoder *marker;
+    void operator()() const {
+      static const char *fields[] = { "markers" };
+      ros::serialization::IStream stream(const_cast<uint8_t *>(data->data()), data->size());
+      uint32_t count;
+      std::memcpy(&count, stream.advance(sizeof(count)), sizeof(count));
+
+      mxArray *markers = 0;
+      for(uint32_t j = 0; j < count; ++j) {
+        ConversionOptions options(Conversion::defaultOptions());
+        if (marker->getIntrospection()) options.merge(Conversion::perMessageOptions(marker->getIntrospection()));
+        ConversionOptions::Snapshot snapshot = options.snapshot();
+        snapshot.type = ConversionOptions::MATLAB_STRUCT;
+        markers = marker->decode(stream, *marker->compile(snapshot), markers, j, count);
+      }
+
+      mxArray *message = mxCreateStructMatrix(1, 1, 1, fields);
+      mxSetField(message, 0, "markers", markers);
+      mxDestroyArray(message);
+    }
+  };
+
+  struct NestedNew {
+    const std::vector<uint8_t> *data;
+    const Decoder *decoder;
+    const Decoder::Plan *plan;
+    void operator()() const {
+      ros::serialization::IStream stream(const_cast<uint8_t *>(data->data()), data->size());
+      mxDestroyArray(decoder->decode(stream, *plan));
+    }
+  };
+
+  void benchmarkNested() {
+    DecoderConstPtr decoder = Decoder::forDefinition("visualization_msgs/MarkerArray", MARKER_ARRAY_DEFINITION);
+    ConversionOptions::Snapshot options = ConversionOptions().snapshot();
+    options.type = ConversionOptions::MATLAB_STRUCT;
+    Decoder::PlanConstPtr plan = decoder->compile(options);
+
+    std::vector<uint8_t> data;
+    append(data, uint32_t(MARKERS));
+    for(std::size_t j = 0; j < MARKERS; ++j) serializeMarker(data, j);
+
+    NestedOld old_path = { &data, decoder->getFields()[0].message.get() };
+    NestedNew new_path = { &data, decoder.get(), plan.get() };
+    double reference = measure(old_path);
+    report("nested", "MarkerArray of 1000, new options per marker (emulated)", reference);
+    report("nested", "MarkerArray of 1000, one pass", measure(new_path), reference);
+  }
+
+  /*
+    transpose: row-major image data into the column-major planes of an HxWxC array, with a naive loop over all
+    elements or with the blocked kernels
+  */
+  struct TransposeNaive {
+    const std::vector<uint8_t> *source;
+    std::vector<uint8_t> *target;
+    std::size_t height, width, channels, element_size;
+    bool to_double;
+    void operator()() const {
+      std::size_t step = width * channels * element_size;
+      for(std::size_t c = 0; c < channels; ++c) {
+        for(std::size_t w = 0; w < width; ++w) {
+          for(std::size_t h = 0; h < height; ++h) {
+            const uint8_t *element = &(*source)[h * step + (w * channels + c) * element_size];
+            std::size_t index = (c * width + w) * height + h;
+            if (to_double) {
+              float value;
+              std::memcpy(&value, element, sizeof(value));
+              reinterpret_cast<double *>(target->data())[index] = value;
+            } else {
+              std::memcpy(&(*target)[index * element_size], element, element_size);
+            }
+          }
+        }
+      }
+    }
+  };
+
+  struct TransposeBlocked {
+    const std::vector<uint8_t> *source;
+    std::vector<uint8_t> *target;
+    std::size_t height, width, channels, element_size;
+    bool to_double;
+    void operator()() const {
+      std::size_t step = width * channels * element_size;
+      std::size_t target_size = to_double ? sizeof(double) : element_size;
+      for(std::size_t c = 0; c < channels; ++c) {
+        uint8_t *plane = &(*target)[c * height * width * target_size];
+        const uint8_t *first = &(*source)[c * element_size];
+        if (to_double) {
+          transposeToDouble(plane, target_size, height * target_size, first, step, channels * element_size, height, width, Decoder::FLOAT32);
+        } else {
+          transpose(plane, target_size, height * target_size, first, step, channels * element_size, height, width, element_size);
+        }
+      }
+    }
+  };
+
+  void benchmarkTranspose(const char *name, std::size_t height, std::size_t width, std::size_t channels, std::size_t element_size, bool to_double) {
+    std::vector<uint8_t> source(height * width * channels * element_size);
+    for(std::size_t i = 0; i < source.size(); ++i) source[i] = i * 7;
+    std::vector<uint8_t> target(height * width * channels * (to_double ? sizeof(double) : element_size));
+
+    TransposeNaive naive = { &source, &target, height, width, channels, element_size, to_double };
+    TransposeBlocked blocked = { &source, &target, height, width, channels, element_size, to_double };
+    double reference = measure(naive);
+    std::string prefix(name);
+    report("transpose", (prefix + ", naive loop").c_str(), reference);
+    report("transpose", (prefix + ", blocked kernels").c_str(), measure(blocked), reference);
+  }
+
+  void benchmarkTransposes() {
+    benchmarkTranspose("Image 480x640 rgb8", 480, 640, 3, 1, false);
+    benchmarkTranspose("Image 480x640 mono8", 480, 640, 1, 1, false);
+    benchmarkTranspose("Image 480x640 32FC1", 480, 640, 1, 4, false);
+    benchmarkTranspose("Image 480x640 32FC1 to double", 480, 640, 1, 4, true);
+  }
+
+  /*
+    publish: a double matrix with one Pose per column serialized for a batch publish, column by column through
+    message instances or in one batch
+  */
+  const std::size_t POSES = 100000;
+
+  struct Pose {
+    double x, y, z;
+    double qx, qy, qz, qw;
+  };
+
+  struct PublishOld {
+    const std::vector<double> *x;
+    std::vector<uint8_t> *data;
+    void operator()() const {
+      double Pose::*fields[] = { &Pose::x, &Pose::y, &Pose::z, &Pose::qx, &Pose::qy, &Pose::qz, &Pose::qw };
+      uint8_t *out = data->data();
+      for(std::size_t j = 0; j < POSES; ++j) {
+        // set each field of an instance through boost::any, then serialize it
+        Pose pose;
+        for(std::size_t i = 0; i < 7; ++i) {
+          boost::any value((*x)[j * 7 + i]);
+          pose.*fields[i] = boost::any_cast<double>(value);
+        }
+        for(std::size_t i = 0; i < 7; ++i) {
+          std::memcpy(out, &(pose.*fields[i]), sizeof(double));
+          out += sizeof(double);
+        }
+      }
+    }
+  };
+
+  struct PublishColumns {
+    const std::vector<double> *x;
+    std::vector<uint8_t> *data;
+    const Decoder *decoder;
+    void operator()() const {
+      uint8_t *out = data->data();
+      for(std::size_t j = 0; j < POSES; ++j) decoder->unflatten(&(*x)[j * 7], out);
+    }
+  };
+
+  struct PublishBatch {
+    const std::vector<double> *x;
+    std::vector<uint8_t> *data;
+    const Decoder *decoder;
+    void operator()() const {
+      decoder->unflatten(x->data(), POSES, data->data(), 7 * sizeof(double));
+    }
+  };
+
+  void benchmarkPublish() {
+    DecoderConstPtr decoder = Decoder::forDefinition("geometry_msgs/Pose",
+        "Point position\n"
+        "Quaternion orientation\n"
+        "================================================================================\n"
+        "MSG: geometry_msgs/Point\n"
+        "float64 x\n"
+        "float64 y\n"
+        "float64 z\n"
+        "================================================================================\n"
+        "MSG: geometry_msgs/Quaternion\n"
+        "float64 x\n"
+        "float64 y\n"
+        "float64 z\n"
+        "float64 w\n");
+
+    std::vector<double> x(POSES * 7);
+    for(std::size_t i = 0; i < x.size(); ++i) x[i] = 0.5 * i;
+    std::vector<uint8_t> data(POSES * 7 * sizeof(double));
+
+    PublishOld old_path = { &x, &data };
+    PublishColumns columns = { &x, &data, decoder.get() };
+    PublishBatch batch = { &x, &data, decoder.get() };
+    double reference = measure(old_path);
+    report("publish", "100000 Poses, instance + boost::any per field (emulated)", reference);
+    report("publish", "100000 Poses, unflatten() per column", measure(columns), reference);
+    report("publish", "100000 Poses, unflatten() batch", measure(batch), reference);
+  }
+
+  struct Section {
+    const char *name;
+    void (*run)();
+  };
+
+  const Section SECTIONS[] = {
+    { "decode", &benchmarkDecode },
+    { "arrays", &benchmarkArrays },
+    { "jobs", &benchmarkJobs },
+    { "nested", &benchmarkNested },
+    { "transpose", &benchmarkTransposes },
+    { "publish", &benchmarkPublish },
+  };
+}
+
+int main(int argc, char **argv)
+{
+  std::size_t count = sizeof(SECTIONS) / sizeof(SECTIONS[0]);
+  for(std::size_t i = 0; i < count; ++i) {
+    bool selected = (argc < 2);
+    for(int j = 1; j < argc; ++j) selected = selected || std::strcmp(argv[j], SECTIONS[i].name) == 0;
+    if (selected) SECTIONS[i].run();
+  }
+  return 0;
+}
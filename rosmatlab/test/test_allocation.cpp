@@ -0,0 +1,186 @@
+//=================================================================================================
+// Copyright (c) 2013, Johannes Meyer, TU Darmstadt
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of the Flight Systems and Automatic Control group,
+//       TU Darmstadt, nor the names of its contributors may be used to
+//       endorse or promote products derived from this software without
+//       specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//=================================================================================================
+
+#include <rosmatlab/decoder.h>
+#include <rosmatlab/handoff.h>
+#include <rosmatlab/serialized_buffers.h>
+#include <gtest/gtest.h>
+
+#include <cstdlib>
+#include <new>
+
+using namespace rosmatlab;
+
+// counts the allocations of the test binary while counting is enabled
+namespace {
+  bool counting = false;
+  std::size_t allocations = 0;
+}
+
+#if __cplusplus >= 201103L
+  #define ROSMATLAB_THROW_BAD_ALLOC
+#else
+  #define ROSMATLAB_THROW_BAD_ALLOC throw(std::bad_alloc)
+#endif
+
+void *operator new(std::size_t size) ROSMATLAB_THROW_BAD_ALLOC {
+  if (counting) ++allocations;
+  void *p = std::malloc(size ? size : 1);
+  if (!p) throw std::bad_alloc();
+  return p;
+}
+void *operator new[](std::size_t size) ROSMATLAB_THROW_BAD_ALLOC { return operator new(size); }
+void operator delete(void *p) throw() { std::free(p); }
+void operator delete[](void *p) throw() { std::free(p); }
+void operator delete(void *p, std::size_t) throw() { std::free(p); }
+void operator delete[](void *p, std::size_t) throw() { std::free(p); }
+
+namespace {
+  const char *STAMPED_DEFINITION =
+      "Header header\n"
+      "string name\n"
+      "int32[3] ids\n"
+      "Point position\n"
+      "time[] stamps\n"
+      "duration timeout\n"
+      "float32[] values\n"
+      "================================================================================\n"
+      "MSG: std_msgs/Header\n"
+      "uint32 seq\n"
+      "time stamp\n"
+      "string frame_id\n"
+      "================================================================================\n"
+      "MSG: test_msgs/Point\n"
+      "float64 x\n"
+      "float64 y\n"
+      "float64 z\n";
+
+  mxArray *createDoubles(std::size_t count, double first) {
+    mxArray *array = mxCreateDoubleMatrix(1, count, mxREAL);
+    for(std::size_t i = 0; i < count; ++i) mxGetPr(array)[i] = first + i;
+    return array;
+  }
+
+  mxArray *createMessage() {
+    const char *header_fields[] = { "seq", "stamp", "frame_id" };
+    mxArray *header = mxCreateStructMatrix(1, 1, 3, header_fields);
+    mxSetField(header, 0, "seq", mxCreateDoubleScalar(7));
+    mxSetField(header, 0, "stamp", mxCreateDoubleScalar(12.5));
+    mxSetField(header, 0, "frame_id", mxCreateString("a_frame_id_longer_than_small_strings"));
+
+    const char *point_fields[] = { "x", "y", "z" };
+    mxArray *position = mxCreateStructMatrix(1, 1, 3, point_fields);
+    mxSetField(position, 0, "x", mxCreateDoubleScalar(1.0));
+    mxSetField(position, 0, "y", mxCreateDoubleScalar(2.0));
+    mxSetField(position, 0, "z", mxCreateDoubleScalar(3.0));
+
+    // more time stamps than fit into one chunk of the conversion to double
+    const char *fields[] = { "header", "name", "ids", "position", "stamps", "timeout", "values" };
+    mxArray *message = mxCreateStructMatrix(1, 1, 7, fields);
+    mxSetField(message, 0, "header", header);
+    mxSetField(message, 0, "name", mxCreateString("sample"));
+    mxSetField(message, 0, "ids", createDoubles(3, 1));
+    mxSetField(message, 0, "position", position);
+    mxSetField(message, 0, "stamps", createDoubles(150, 100.25));
+    mxSetField(message, 0, "timeout", mxCreateDoubleScalar(0.5));
+    mxSetField(message, 0, "values", createDoubles(1000, 0));
+    return message;
+  }
+}
+
+TEST(Allocation, EncodeIsAllocationFree)
+{
+  DecoderConstPtr decoder = Decoder::forDefinition("test_msgs/Stamped", STAMPED_DEFINITION);
+  mxArray *message = createMessage();
+
+  // the first message grows the buffer, later messages of the same size reuse it
+  std::vector<uint8_t> buffer;
+  buffer.reserve(decoder->getEncodedLength(message, 0));
+  ASSERT_TRUE(decoder->encode(message, 0, buffer));
+  std::size_t length = buffer.size();
+  EXPECT_EQ(length, decoder->getEncodedLength(message, 0));
+
+  allocations = 0;
+  counting = true;
+  bool encoded = true;
+  for(std::size_t i = 0; i < 1000; ++i) {
+    buffer.clear();
+    buffer.reserve(decoder->getEncodedLength(message, 0));
+    encoded = decoder->encode(message, 0, buffer) && encoded;
+  }
+  counting = false;
+
+  EXPECT_TRUE(encoded);
+  EXPECT_EQ(length, buffer.size());
+  EXPECT_EQ(0u, allocations);
+  mxDestroyArray(message);
+}
+
+// The path of Publisher::publish() in asynchronous mode, which needs a ROS master and is therefore driven by hand:
+// messages are serialized into the pool of Conversion::serialize(), queued for the publisher thread, held by
+// roscpp for a while and recycled. Once the pool and the queues are filled up, nothing is allocated.
+TEST(Allocation, PublishIsAllocationFree)
+{
+  typedef boost::shared_ptr<ros::SerializedMessage> OutgoingPtr;
+  static const std::size_t QUEUE_SIZE = 4;
+  static const std::size_t HELD = 3;
+
+  DecoderConstPtr decoder = Decoder::forDefinition("test_msgs/Stamped", STAMPED_DEFINITION);
+  mxArray *message = createMessage();
+  SerializedBuffers buffers;
+  Handoff<OutgoingPtr> queue(QUEUE_SIZE);
+  Handoff<OutgoingPtr> recycled(QUEUE_SIZE + 2);
+  ros::SerializedMessage held[HELD];
+
+  bool encoded = true;
+  for(std::size_t i = 0; i < 1000 + 100; ++i) {
+    if (i == 100) {
+      allocations = 0;
+      counting = true;
+    }
+
+    OutgoingPtr outgoing;
+    if (!recycled.pop(outgoing)) outgoing.reset(new ros::SerializedMessage);
+    encoded = buffers.encode(*decoder, message, 0, *outgoing) && encoded;
+    ASSERT_TRUE(queue.push(outgoing));
+    outgoing.reset();
+
+    // publisher thread: roscpp keeps a reference to the last messages until they have been written
+    ASSERT_TRUE(queue.pop(outgoing));
+    held[i % HELD] = *outgoing;
+    *outgoing = ros::SerializedMessage();
+    ASSERT_TRUE(recycled.push(outgoing));
+  }
+  counting = false;
+
+  EXPECT_TRUE(encoded);
+  EXPECT_EQ(0u, allocations);
+  EXPECT_EQ(HELD + 1, buffers.size());
+  EXPECT_EQ(decoder->getEncodedLength(message, 0) + sizeof(uint32_t), held[0].num_bytes);
+  mxDestroyArray(message);
+}
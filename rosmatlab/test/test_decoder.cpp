@@ -0,0 +1,237 @@
+//=================================================================================================
+// Copyright (c) 2013, Johannes Meyer, TU Darmstadt
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of the Flight Systems and Automatic Control group,
+//       TU Darmstadt, nor the names of its contributors may be used to
+//       endorse or promote products derived from this software without
+//       specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//=================================================================================================
+
+#include <rosmatlab/decoder.h>
+#include <rosmatlab/exception.h>
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <cstring>
+
+using namespace rosmatlab;
+
+namespace {
+  const char *SAMPLE_DEFINITION =
+      "# comments and constants are skipped\n"
+      "int8 CONSTANT=1\n"
+      "Header header\n"
+      "string name\n"
+      "int32[3] ids\n"
+      "Point position  # a message of the same package\n"
+      "float32 ratio\n"
+      "bool valid\n"
+      "================================================================================\n"
+      "MSG: std_msgs/Header\n"
+      "uint32 seq\n"
+      "time stamp\n"
+      "string frame_id\n"
+      "================================================================================\n"
+      "MSG: test_msgs/Point\n"
+      "float64 x\n"
+      "float64 y\n"
+      "float64 z\n";
+
+  // serializes values in the little-endian wire format of ROS
+  struct Writer {
+    std::vector<uint8_t> data;
+    template <typename T> Writer& operator<<(T value) {
+      std::size_t offset = data.size();
+      data.resize(offset + sizeof(T));
+      std::memcpy(&data[offset], &value, sizeof(T));
+      return *this;
+    }
+    Writer& operator<<(const std::string& value) {
+      *this << static_cast<uint32_t>(value.size());
+      data.insert(data.end(), value.begin(), value.end());
+      return *this;
+    }
+  };
+
+  void writeSample(Writer& writer) {
+    writer << uint32_t(7) << uint32_t(12) << uint32_t(500000000) << std::string("base_link")
+           << std::string("sample") << int32_t(-1) << int32_t(2) << int32_t(3)
+           << 1.5 << -2.5 << 1e10 << 0.25f << uint8_t(1);
+  }
+}
+
+TEST(Decoder, ParsesDefinition)
+{
+  DecoderConstPtr decoder = Decoder::forDefinition("test_msgs/Sample", SAMPLE_DEFINITION);
+  const Decoder::Fields& fields = decoder->getFields();
+  ASSERT_EQ(6u, fields.size());
+
+  EXPECT_EQ("header", fields[0].name);
+  EXPECT_EQ(Decoder::MESSAGE, fields[0].type);
+  EXPECT_EQ("std_msgs/Header", fields[0].message->getDataType());
+  EXPECT_EQ(Decoder::TIME, fields[0].message->getFields()[1].type);
+
+  EXPECT_EQ(Decoder::STRING, fields[1].type);
+  EXPECT_FALSE(fields[1].is_array);
+
+  EXPECT_EQ(Decoder::INT32, fields[2].type);
+  EXPECT_TRUE(fields[2].is_array);
+  EXPECT_EQ(3u, fields[2].array_length);
+
+  EXPECT_EQ("test_msgs/Point", fields[3].message->getDataType());
+  EXPECT_EQ(Decoder::FLOAT32, fields[4].type);
+  EXPECT_EQ(Decoder::BOOL, fields[5].type);
+
+  ASSERT_EQ(6u, decoder->getFieldNames().size());
+  EXPECT_STREQ("position", decoder->getFieldNames()[3]);
+}
+
+TEST(Decoder, UnknownTypeThrows)
+{
+  EXPECT_THROW(Decoder::forDefinition("test_msgs/Broken", "Missing missing\n"), std::exception);
+}
+
+TEST(Decoder, Layout)
+{
+  DecoderConstPtr sample = Decoder::forDefinition("test_msgs/Sample", SAMPLE_DEFINITION);
+  EXPECT_FALSE(sample->hasPayload());
+  EXPECT_EQ(3u + 1 + 3 + 3 + 2, sample->getFlatSize());
+
+  // the encoded length is only fixed without strings and variable-length arrays
+  DecoderConstPtr point = Decoder::forDefinition("test_msgs/Point", "float64 x\nfloat64 y\nfloat64 z\n");
+  EXPECT_EQ(24u, point->getEncodedLength(0, 0));
+
+  DecoderConstPtr cloud = Decoder::forDefinition("test_msgs/Cloud", "uint32 width\nfloat32[] data\n");
+  EXPECT_TRUE(cloud->hasPayload());
+  EXPECT_EQ(8u, cloud->getEncodedLength(0, 0));
+}
+
+TEST(Decoder, FlattensSerializedMessage)
+{
+  DecoderConstPtr decoder = Decoder::forDefinition("test_msgs/Sample", SAMPLE_DEFINITION);
+  Writer writer;
+  writeSample(writer);
+
+  std::vector<double> x(decoder->getFlatSize(), -1.0);
+  std::vector<std::string> strings;
+  ros::serialization::IStream stream(writer.data.data(), writer.data.size());
+  double *end = decoder->flatten(stream, x.data(), &strings);
+
+  EXPECT_EQ(x.data() + x.size(), end);
+  EXPECT_EQ(0u, stream.getLength());
+
+  EXPECT_EQ(7.0, x[0]);
+  EXPECT_DOUBLE_EQ(12.5, x[1]);
+  EXPECT_TRUE(std::isnan(x[2]));
+  EXPECT_TRUE(std::isnan(x[3]));
+  EXPECT_EQ(-1.0, x[4]);
+  EXPECT_EQ(3.0, x[6]);
+  EXPECT_EQ(1.5, x[7]);
+  EXPECT_EQ(1e10, x[9]);
+  EXPECT_EQ(0.25, x[10]);
+  EXPECT_EQ(1.0, x[11]);
+
+  ASSERT_EQ(2u, strings.size());
+  EXPECT_EQ("base_link", strings[0]);
+  EXPECT_EQ("sample", strings[1]);
+}
+
+// like Subscriber::poll() in batch mode, the first message allocates the array for all of them
+TEST(Decoder, DecodesBatchIntoOneArray)
+{
+  DecoderConstPtr decoder = Decoder::forDefinition("test_msgs/Sample", SAMPLE_DEFINITION);
+  ConversionOptions::Snapshot options = ConversionOptions().snapshot();
+  options.type = ConversionOptions::MATLAB_STRUCT;
+  Decoder::PlanConstPtr plan = decoder->compile(options);
+
+  mxArray *batch = 0;
+  for(std::size_t j = 0; j < 3; ++j) {
+    Writer writer;
+    writeSample(writer);
+    std::memcpy(writer.data.data(), &j, sizeof(uint32_t));
+    ros::serialization::IStream stream(writer.data.data(), writer.data.size());
+    mxArray *result = decoder->decode(stream, *plan, batch, j, 3);
+    if (batch) EXPECT_EQ(batch, result);
+    batch = result;
+  }
+
+  ASSERT_TRUE(batch && mxIsStruct(batch));
+  ASSERT_EQ(3u, mxGetNumberOfElements(batch));
+  for(std::size_t j = 0; j < 3; ++j) {
+    const mxArray *header = mxGetField(batch, j, "header");
+    ASSERT_TRUE(header && mxIsStruct(header));
+    EXPECT_EQ(static_cast<double>(j), mxGetScalar(mxGetField(header, 0, "seq")));
+    ASSERT_TRUE(mxGetField(batch, j, "position"));
+    EXPECT_EQ(1e10, mxGetScalar(mxGetField(mxGetField(batch, j, "position"), 0, "z")));
+  }
+  mxDestroyArray(batch);
+}
+
+TEST(Decoder, TruncatedMessageThrows)
+{
+  DecoderConstPtr decoder = Decoder::forDefinition("test_msgs/Sample", SAMPLE_DEFINITION);
+  Writer writer;
+  writeSample(writer);
+
+  std::vector<double> x(decoder->getFlatSize());
+  for(std::size_t length = 0; length < writer.data.size(); length += 5) {
+    ros::serialization::IStream stream(writer.data.data(), length);
+    EXPECT_THROW(decoder->flatten(stream, x.data()), ros::serialization::StreamOverrunException) << "length " << length;
+  }
+}
+
+TEST(Decoder, NestedArraysRoundTrip)
+{
+  DecoderConstPtr decoder = Decoder::forDefinition("test_msgs/Path",
+      "Point[] points\n"
+      "Point[2] corners\n"
+      "================================================================================\n"
+      "MSG: test_msgs/Point\n"
+      "float64 x\n"
+      "float64 y\n"
+      "float64 z\n");
+
+  Writer writer;
+  writer << uint32_t(3);
+  for(int i = 0; i < 3 * 3 + 2 * 3; ++i) writer << 0.5 * i;
+
+  // nested messages are decoded into one struct array per field
+  ConversionOptions::Snapshot options = ConversionOptions().snapshot();
+  options.type = ConversionOptions::MATLAB_STRUCT;
+  ros::serialization::IStream stream(writer.data.data(), writer.data.size());
+  mxArray *message = decoder->decode(stream, *decoder->compile(options));
+  EXPECT_EQ(0u, stream.getLength());
+
+  const mxArray *points = mxGetField(message, 0, "points");
+  ASSERT_TRUE(points && mxIsStruct(points));
+  ASSERT_EQ(3u, mxGetNumberOfElements(points));
+  EXPECT_EQ(3.5, mxGetScalar(mxGetField(points, 2, "y")));
+  const mxArray *corners = mxGetField(message, 0, "corners");
+  ASSERT_TRUE(corners && mxIsStruct(corners));
+  ASSERT_EQ(2u, mxGetNumberOfElements(corners));
+  EXPECT_EQ(7.0, mxGetScalar(mxGetField(corners, 1, "z")));
+
+  std::vector<uint8_t> buffer;
+  ASSERT_TRUE(decoder->encode(message, 0, buffer));
+  EXPECT_EQ(writer.data, buffer);
+  mxDestroyArray(message);
+}
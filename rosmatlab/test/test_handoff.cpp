@@ -0,0 +1,224 @@
+//=================================================================================================
+// Copyright (c) 2013, Johannes Meyer, TU Darmstadt
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of the Flight Systems and Automatic Control group,
+//       TU Darmstadt, nor the names of its contributors may be used to
+//       endorse or promote products derived from this software without
+//       specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//=================================================================================================
+
+#include <rosmatlab/handoff.h>
+#include <gtest/gtest.h>
+
+#include <boost/thread/thread.hpp>
+#include <boost/bind.hpp>
+#include <boost/shared_ptr.hpp>
+
+using namespace rosmatlab;
+
+namespace {
+  typedef Handoff<std::size_t> Queue;
+
+  // A handoff takes microseconds. A lost wakeup leaves the waiting thread asleep until its deadline,
+  // which shows up as a wait that takes longer than MAX_WAIT.
+  const boost::posix_time::time_duration DEADLINE = boost::posix_time::seconds(2);
+  const boost::posix_time::time_duration MAX_WAIT = boost::posix_time::seconds(1);
+
+  struct Side {
+    Side() : count(0), dropped(0), errors(0), max_wait(boost::posix_time::seconds(0)) {}
+    std::size_t count;
+    std::size_t dropped;
+    std::size_t errors;
+    boost::posix_time::time_duration max_wait;
+
+    void waited(const boost::system_time& start) {
+      max_wait = std::max(max_wait, boost::get_system_time() - start);
+    }
+  };
+
+  void produce(Queue& queue, std::size_t count, bool blocking, Side& side) {
+    for(std::size_t i = 1; i <= count; ++i) {
+      while(!queue.push(i)) {
+        if (!blocking) {
+          side.dropped++;
+          break;
+        }
+        boost::system_time start = boost::get_system_time();
+        if (!queue.waitForSpace(start + DEADLINE)) side.errors++;
+        side.waited(start);
+      }
+    }
+    queue.close();
+  }
+
+  // values are received in order, gaps only if the producer has dropped them
+  void consume(Queue& queue, Side& side) {
+    std::size_t value, last = 0;
+    while(true) {
+      while(queue.pop(value)) {
+        if (value <= last) side.errors++;
+        side.dropped += value - last - 1;
+        last = value;
+        side.count++;
+      }
+      boost::system_time start = boost::get_system_time();
+      bool data = queue.waitForData(start + DEADLINE);
+      side.waited(start);
+      if (!data) break;
+    }
+  }
+
+  // counts its live instances, like the message events handed over by a Subscriber
+  struct Event {
+    explicit Event(std::size_t value) : value(value) { live++; }
+    ~Event() { live--; }
+    std::size_t value;
+    static boost::atomic<int> live;
+  };
+  boost::atomic<int> Event::live(0);
+  typedef boost::shared_ptr<Event> EventPtr;
+
+  void produceEvents(Handoff<EventPtr>& queue, std::size_t count) {
+    for(std::size_t i = 1; i <= count; ++i) {
+      EventPtr event(new Event(i));
+      while(!queue.push(event)) queue.waitForSpace();
+    }
+    queue.close();
+  }
+
+  void run(std::size_t capacity, std::size_t count, bool blocking, Side& producer, Side& consumer) {
+    Queue queue(capacity);
+    boost::thread thread(boost::bind(&consume, boost::ref(queue), boost::ref(consumer)));
+    produce(queue, count, blocking, producer);
+    thread.join();
+  }
+}
+
+TEST(Handoff, Empty)
+{
+  Queue queue(4);
+  std::size_t value;
+  EXPECT_TRUE(queue.empty());
+  EXPECT_FALSE(queue.pop(value));
+  EXPECT_FALSE(queue.waitForData(boost::get_system_time() + boost::posix_time::milliseconds(10)));
+}
+
+TEST(Handoff, Capacity)
+{
+  Queue queue(2);
+  std::size_t value = 0;
+  EXPECT_TRUE(queue.push(1));
+  EXPECT_TRUE(queue.push(2));
+  EXPECT_TRUE(queue.full());
+  EXPECT_FALSE(queue.push(3));
+  EXPECT_FALSE(queue.waitForSpace(boost::get_system_time() + boost::posix_time::milliseconds(10)));
+  EXPECT_EQ(2u, queue.size());
+  EXPECT_TRUE(queue.pop(value));
+  EXPECT_EQ(1u, value);
+  EXPECT_TRUE(queue.waitForSpace(boost::get_system_time()));
+}
+
+// like Subscriber::callback(), which counts the messages that arrive while the buffer is full
+TEST(Handoff, FullBufferKeepsOldest)
+{
+  Queue queue(3);
+  std::size_t value = 0, dropped = 0;
+  for(std::size_t i = 1; i <= 5; ++i) {
+    if (queue.full() || !queue.push(i)) dropped++;
+  }
+  EXPECT_EQ(2u, dropped);
+  EXPECT_EQ(3u, queue.size());
+
+  for(std::size_t i = 1; i <= 3; ++i) {
+    ASSERT_TRUE(queue.pop(value));
+    EXPECT_EQ(i, value);
+  }
+  EXPECT_TRUE(queue.empty());
+  EXPECT_TRUE(queue.push(6));
+}
+
+TEST(Handoff, CloseKeepsQueuedValues)
+{
+  Queue queue(4);
+  std::size_t value = 0;
+  queue.push(1);
+  queue.close();
+  EXPECT_TRUE(queue.waitForData());
+  EXPECT_TRUE(queue.pop(value));
+  EXPECT_EQ(1u, value);
+  EXPECT_FALSE(queue.waitForData());
+}
+
+// every value is handed over separately, so both threads wait for each other all the time
+TEST(Handoff, StressBlockingDepth1)
+{
+  Side producer, consumer;
+  run(1, 200000, true, producer, consumer);
+  EXPECT_EQ(0u, producer.errors);
+  EXPECT_EQ(0u, consumer.errors);
+  EXPECT_EQ(200000u, consumer.count);
+  EXPECT_EQ(0u, consumer.dropped);
+  EXPECT_LT(producer.max_wait, MAX_WAIT);
+  EXPECT_LT(consumer.max_wait, MAX_WAIT);
+}
+
+TEST(Handoff, StressBlocking)
+{
+  Side producer, consumer;
+  run(16, 4000000, true, producer, consumer);
+  EXPECT_EQ(0u, producer.errors);
+  EXPECT_EQ(0u, consumer.errors);
+  EXPECT_EQ(4000000u, consumer.count);
+  EXPECT_LT(producer.max_wait, MAX_WAIT);
+  EXPECT_LT(consumer.max_wait, MAX_WAIT);
+}
+
+// like the spinner thread of a Subscriber, which drops messages if the buffer is full
+TEST(Handoff, StressDropping)
+{
+  Side producer, consumer;
+  run(4, 4000000, false, producer, consumer);
+  EXPECT_EQ(0u, consumer.errors);
+  EXPECT_EQ(4000000u, consumer.count + producer.dropped);
+  EXPECT_LT(consumer.max_wait, MAX_WAIT);
+}
+
+// the shared pointers are released on the Matlab thread, every event arrives intact and is destroyed once
+TEST(Handoff, StressSharedPointers)
+{
+  Handoff<EventPtr> queue(16);
+  boost::thread thread(boost::bind(&produceEvents, boost::ref(queue), 1000000));
+
+  std::size_t count = 0, errors = 0;
+  EventPtr event;
+  while(queue.waitForData()) {
+    while(queue.pop(event)) {
+      if (!event || event->value != ++count) errors++;
+      event.reset();
+    }
+  }
+  thread.join();
+
+  EXPECT_EQ(0u, errors);
+  EXPECT_EQ(1000000u, count);
+  EXPECT_EQ(0, Event::live.load());
+}
@@ -0,0 +1,182 @@
+//=================================================================================================
+// Copyright (c) 2013, Johannes Meyer, TU Darmstadt
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of the Flight Systems and Automatic Control group,
+//       TU Darmstadt, nor the names of its contributors may be used to
+//       endorse or promote products derived from this software without
+//       specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//=================================================================================================
+
+#include <rosmatlab/decoder.h>
+#include <rosmatlab/exception.h>
+#include <gtest/gtest.h>
+
+#include <cstring>
+
+using namespace rosmatlab;
+
+namespace {
+  template <typename T> std::vector<uint8_t> serialize(const std::vector<T>& values) {
+    std::vector<uint8_t> data(values.size() * sizeof(T));
+    if (!data.empty()) std::memcpy(data.data(), values.data(), data.size());
+    return data;
+  }
+}
+
+TEST(Jobs, SmallPayloads)
+{
+  Decoder::Jobs jobs;
+  std::vector<int16_t> shorts;
+  for(int i = -5; i < 5; ++i) shorts.push_back(i * 1000);
+  std::vector<uint8_t> source = serialize(shorts);
+  uint8_t bools[] = { 0, 1, 2, 0, 255 };
+
+  std::vector<uint8_t> copied(source.size());
+  std::vector<double> doubles(shorts.size());
+  mxLogical logicals[5];
+  jobs.copy(copied.data(), source.data(), source.size());
+  jobs.toDouble(doubles.data(), source.data(), Decoder::INT16, shorts.size());
+  jobs.toLogical(logicals, bools, 5);
+  EXPECT_EQ(2 * source.size() + 5, jobs.length());
+
+  jobs.run();
+  EXPECT_EQ(0u, jobs.length());
+  EXPECT_EQ(source, copied);
+  for(std::size_t i = 0; i < shorts.size(); ++i) EXPECT_EQ(static_cast<double>(shorts[i]), doubles[i]);
+  for(std::size_t i = 0; i < 5; ++i) EXPECT_EQ(bools[i] != 0, static_cast<bool>(logicals[i]));
+}
+
+TEST(Jobs, LargePayloadsRunInParallel)
+{
+  // more than PARALLEL_LENGTH bytes, split into chunks with a remainder
+  std::size_t count = Decoder::Jobs::PARALLEL_LENGTH / sizeof(float) + 12345;
+  std::vector<float> floats(count);
+  for(std::size_t i = 0; i < count; ++i) floats[i] = static_cast<float>(i) * 0.5f;
+  std::vector<uint8_t> source = serialize(floats);
+
+  Decoder::Jobs jobs;
+  std::vector<uint8_t> copied(source.size());
+  std::vector<double> doubles(count, -1.0);
+  jobs.copy(copied.data(), source.data(), source.size());
+  jobs.toDouble(doubles.data(), source.data(), Decoder::FLOAT32, count);
+  jobs.run();
+
+  EXPECT_TRUE(copied == source);
+  for(std::size_t i = 0; i < count; ++i) {
+    if (doubles[i] != static_cast<double>(floats[i])) FAIL() << "element " << i << " is " << doubles[i];
+  }
+}
+
+TEST(Jobs, BuffersLiveUntilRun)
+{
+  Decoder::Jobs jobs;
+  std::vector<uint32_t> targets(2 * Decoder::Jobs::MIN_LENGTH);
+
+  // the sources are owned by the jobs and released by run()
+  std::vector<uint8_t>& held = jobs.hold(Decoder::Jobs::MIN_LENGTH * sizeof(uint32_t));
+  uint8_t *allocated = jobs.allocate(Decoder::Jobs::MIN_LENGTH * sizeof(uint32_t));
+  for(std::size_t i = 0; i < Decoder::Jobs::MIN_LENGTH; ++i) {
+    uint32_t a = i, b = i + Decoder::Jobs::MIN_LENGTH;
+    std::memcpy(&held[i * sizeof(uint32_t)], &a, sizeof(a));
+    std::memcpy(&allocated[i * sizeof(uint32_t)], &b, sizeof(b));
+  }
+  jobs.copy(&targets[0], held.data(), held.size());
+  jobs.copy(&targets[Decoder::Jobs::MIN_LENGTH], allocated, Decoder::Jobs::MIN_LENGTH * sizeof(uint32_t));
+  jobs.run();
+
+  for(std::size_t i = 0; i < targets.size(); ++i) EXPECT_EQ(i, targets[i]);
+}
+
+TEST(Jobs, InternsStringsPerIndex)
+{
+  const char *fieldnames[] = { "strings" };
+  mxArray *parent = mxCreateStructMatrix(1, 1, 1, fieldnames);
+  mxArray *index = mxCreateNumericMatrix(4, 1, mxUINT32_CLASS, mxREAL);
+  mxSetField(parent, 0, "strings", index);
+
+  Decoder::Jobs jobs;
+  const char *values[] = { "b", "a", "b", "c" };
+  uint32_t *ids = static_cast<uint32_t *>(mxGetData(index));
+  for(std::size_t i = 0; i < 4; ++i) ids[i] = jobs.intern(parent, "strings", index, values[i], false);
+  EXPECT_EQ(1u, ids[0]);
+  EXPECT_EQ(2u, ids[1]);
+  EXPECT_EQ(1u, ids[2]);
+  EXPECT_EQ(3u, ids[3]);
+
+  // the index array is replaced by a struct with index and dictionary
+  jobs.finish();
+  const mxArray *strings = mxGetField(parent, 0, "strings");
+  ASSERT_TRUE(strings && mxIsStruct(strings));
+  EXPECT_EQ(index, mxGetField(strings, 0, "index"));
+  const mxArray *dictionary = mxGetField(strings, 0, "dictionary");
+  ASSERT_TRUE(dictionary && mxIsCell(dictionary));
+  ASSERT_EQ(3u, mxGetNumberOfElements(dictionary));
+  char value[2];
+  mxGetString(mxGetCell(dictionary, 1), value, sizeof(value));
+  EXPECT_STREQ("a", value);
+
+  mxDestroyArray(parent);
+}
+
+// the dictionary of a batch is held by the jobs, so decoding dictionary-encoded strings without them fails
+TEST(Jobs, DictionaryNeedsJobs)
+{
+  DecoderConstPtr decoder = Decoder::forDefinition("test_msgs/Named", "string name\nint32 id\n");
+  ConversionOptions::Snapshot options = ConversionOptions().snapshot();
+  options.type = ConversionOptions::MATLAB_COLUMNAR;
+  options.strings = ConversionOptions::STRINGS_DICTIONARY;
+  Decoder::PlanConstPtr plan = decoder->compile(options);
+
+  const char *names[] = { "left", "right", "left" };
+  std::vector<std::vector<uint8_t> > messages(3);
+  for(std::size_t i = 0; i < messages.size(); ++i) {
+    uint32_t length = std::strlen(names[i]);
+    int32_t id = i;
+    messages[i].resize(sizeof(length) + length + sizeof(id));
+    std::memcpy(&messages[i][0], &length, sizeof(length));
+    std::memcpy(&messages[i][sizeof(length)], names[i], length);
+    std::memcpy(&messages[i][sizeof(length) + length], &id, sizeof(id));
+  }
+
+  {
+    ros::serialization::IStream stream(messages[0].data(), messages[0].size());
+    EXPECT_THROW(decoder->decode(stream, *plan, 0, 0, messages.size()), Exception);
+  }
+
+  Decoder::Jobs jobs;
+  mxArray *target = 0;
+  for(std::size_t i = 0; i < messages.size(); ++i) {
+    ros::serialization::IStream stream(messages[i].data(), messages[i].size());
+    target = decoder->decode(stream, *plan, target, i, messages.size(), &jobs);
+  }
+  jobs.finish();
+
+  const mxArray *strings = mxGetField(target, 0, "name");
+  ASSERT_TRUE(strings && mxIsStruct(strings));
+  const mxArray *dictionary = mxGetField(strings, 0, "dictionary");
+  ASSERT_TRUE(dictionary && mxIsCell(dictionary));
+  EXPECT_EQ(2u, mxGetNumberOfElements(dictionary));
+  const uint32_t *index = static_cast<const uint32_t *>(mxGetData(mxGetField(strings, 0, "index")));
+  EXPECT_EQ(index[0], index[2]);
+  EXPECT_NE(index[0], index[1]);
+  mxDestroyArray(target);
+}
@@ -0,0 +1,213 @@
+//=================================================================================================
+// Copyright (c) 2013, Johannes Meyer, TU Darmstadt
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of the Flight Systems and Automatic Control group,
+//       TU Darmstadt, nor the names of its contributors may be used to
+//       endorse or promote products derived from this software without
+//       specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//=================================================================================================
+
+#include <rosmatlab/decoder.h>
+#include <rosmatlab/exception.h>
+#include <gtest/gtest.h>
+
+#include <boost/lexical_cast.hpp>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+
+using namespace rosmatlab;
+
+namespace {
+  // lengths around the SSE2 block sizes, so that both the vectorized loops and the remainders are covered
+  const std::size_t LENGTHS[] = { 1, 3, 4, 7, 8, 15, 16, 17, 33, 100 };
+
+  template <typename T> std::vector<T> values(std::size_t count) {
+    std::vector<T> result(count);
+    for(std::size_t i = 0; i < count; ++i) {
+      switch(i % 4) {
+        case 0: result[i] = std::numeric_limits<T>::min(); break;
+        case 1: result[i] = std::numeric_limits<T>::max(); break;
+        default: result[i] = static_cast<T>(std::rand() % 200) - static_cast<T>(std::numeric_limits<T>::is_signed ? 100 : 0); break;
+      }
+    }
+    return result;
+  }
+
+  // flattens a fixed-length array field and serializes it back
+  template <typename T> void roundTrip(const std::string& type) {
+    for(std::size_t k = 0; k < sizeof(LENGTHS)/sizeof(*LENGTHS); ++k) {
+      std::size_t count = LENGTHS[k];
+      SCOPED_TRACE(type + "[" + boost::lexical_cast<std::string>(count) + "]");
+      DecoderConstPtr decoder = Decoder::forDefinition("test_msgs/Array", type + "[" + boost::lexical_cast<std::string>(count) + "] data\n");
+      ASSERT_EQ(count, decoder->getFlatSize());
+      ASSERT_EQ(count * sizeof(T), decoder->getEncodedLength(0, 0));
+
+      std::vector<T> source = values<T>(count);
+      std::vector<uint8_t> serialized(count * sizeof(T));
+      std::memcpy(serialized.data(), source.data(), serialized.size());
+
+      std::vector<double> x(count);
+      ros::serialization::IStream stream(serialized.data(), serialized.size());
+      decoder->flatten(stream, x.data());
+      for(std::size_t i = 0; i < count; ++i) EXPECT_EQ(static_cast<double>(source[i]), x[i]) << "element " << i;
+
+      std::vector<uint8_t> encoded(serialized.size() + 1, 0xAA);
+      uint8_t *end = encoded.data();
+      decoder->unflatten(x.data(), end);
+      EXPECT_EQ(encoded.data() + serialized.size(), end);
+      EXPECT_EQ(0, std::memcmp(encoded.data(), serialized.data(), serialized.size()));
+      EXPECT_EQ(0xAA, encoded.back());
+    }
+  }
+}
+
+TEST(Numeric, Int8)    { roundTrip<int8_t>("int8"); }
+TEST(Numeric, UInt8)   { roundTrip<uint8_t>("uint8"); }
+TEST(Numeric, Int16)   { roundTrip<int16_t>("int16"); }
+TEST(Numeric, UInt16)  { roundTrip<uint16_t>("uint16"); }
+TEST(Numeric, Int32)   { roundTrip<int32_t>("int32"); }
+TEST(Numeric, UInt32)  { roundTrip<uint32_t>("uint32"); }
+TEST(Numeric, Float32) { roundTrip<float>("float32"); }
+TEST(Numeric, Float64) { roundTrip<double>("float64"); }
+
+TEST(Numeric, Bool)
+{
+  DecoderConstPtr decoder = Decoder::forDefinition("test_msgs/Flags", "bool[17] flags\n");
+  std::vector<uint8_t> serialized(17);
+  for(std::size_t i = 0; i < serialized.size(); ++i) serialized[i] = i % 3 == 0;
+
+  std::vector<double> x(17);
+  ros::serialization::IStream stream(serialized.data(), serialized.size());
+  decoder->flatten(stream, x.data());
+  for(std::size_t i = 0; i < x.size(); ++i) EXPECT_EQ(i % 3 == 0 ? 1.0 : 0.0, x[i]);
+}
+
+// 64 bit integers are exact in doubles up to 2^53
+TEST(Numeric, Int64)
+{
+  DecoderConstPtr decoder = Decoder::forDefinition("test_msgs/Counters", "int64 a\nuint64 b\n");
+  int64_t a = -(int64_t(1) << 53);
+  uint64_t b = uint64_t(1) << 53;
+  std::vector<uint8_t> serialized(16);
+  std::memcpy(&serialized[0], &a, 8);
+  std::memcpy(&serialized[8], &b, 8);
+
+  std::vector<double> x(2);
+  ros::serialization::IStream stream(serialized.data(), serialized.size());
+  decoder->flatten(stream, x.data());
+  EXPECT_EQ(static_cast<double>(a), x[0]);
+  EXPECT_EQ(static_cast<double>(b), x[1]);
+
+  std::vector<uint8_t> encoded(16);
+  uint8_t *end = encoded.data();
+  decoder->unflatten(x.data(), end);
+  EXPECT_EQ(serialized, encoded);
+}
+
+TEST(Numeric, Times)
+{
+  DecoderConstPtr decoder = Decoder::forDefinition("test_msgs/Times", "time stamp\nduration timeout\n");
+  std::vector<uint8_t> serialized(16);
+  uint32_t stamp[2] = { 1400000000, 250000000 };
+  int32_t timeout[2] = { 3, 500000000 };
+  std::memcpy(&serialized[0], stamp, 8);
+  std::memcpy(&serialized[8], timeout, 8);
+
+  std::vector<double> x(2);
+  ros::serialization::IStream stream(serialized.data(), serialized.size());
+  decoder->flatten(stream, x.data());
+  EXPECT_DOUBLE_EQ(1400000000.25, x[0]);
+  EXPECT_DOUBLE_EQ(3.5, x[1]);
+
+  std::vector<uint8_t> encoded(16);
+  uint8_t *end = encoded.data();
+  decoder->unflatten(x.data(), end);
+  EXPECT_EQ(serialized, encoded);
+}
+
+// doubles are rounded and saturated like int8(x) in Matlab, NaN becomes 0
+TEST(Numeric, Saturate)
+{
+  DecoderConstPtr decoder = Decoder::forDefinition("test_msgs/Bytes", "int8[8] data\n");
+  const double x[8] = { std::numeric_limits<double>::quiet_NaN(), -1000.0, 1000.0, 2.5, -2.5, 1.4, -128.4, std::numeric_limits<double>::infinity() };
+  const int8_t expected[8] = { 0, -128, 127, 3, -3, 1, -128, 127 };
+
+  std::vector<uint8_t> encoded(8);
+  uint8_t *end = encoded.data();
+  decoder->unflatten(x, end);
+  EXPECT_EQ(0, std::memcmp(expected, encoded.data(), 8));
+
+  mxArray *data = mxCreateDoubleMatrix(1, 8, mxREAL);
+  std::memcpy(mxGetPr(data), x, sizeof(x));
+  const char *fields[] = { "data" };
+  mxArray *message = mxCreateStructMatrix(1, 1, 1, fields);
+  mxSetField(message, 0, "data", data);
+  std::vector<uint8_t> buffer;
+  ASSERT_TRUE(decoder->encode(message, 0, buffer));
+  ASSERT_EQ(8u, buffer.size());
+  EXPECT_EQ(0, std::memcmp(expected, buffer.data(), 8));
+
+  // negative integers saturate at 0 in unsigned fields
+  DecoderConstPtr unsigned_decoder = Decoder::forDefinition("test_msgs/Counts", "uint16[2] data\n");
+  mxArray *counts = mxCreateNumericMatrix(1, 2, mxINT32_CLASS, mxREAL);
+  static_cast<int32_t *>(mxGetData(counts))[0] = -5;
+  static_cast<int32_t *>(mxGetData(counts))[1] = 100000;
+  mxSetField(message, 0, "data", counts);
+  buffer.clear();
+  ASSERT_TRUE(unsigned_decoder->encode(message, 0, buffer));
+  uint16_t values[2];
+  std::memcpy(values, buffer.data(), sizeof(values));
+  EXPECT_EQ(0, values[0]);
+  EXPECT_EQ(65535, values[1]);
+
+  // classes that are not numeric cannot be encoded
+  mxSetField(message, 0, "data", mxCreateCellMatrix(1, 8));
+  buffer.clear();
+  EXPECT_THROW(decoder->encode(message, 0, buffer), Exception);
+  mxDestroyArray(message);
+}
+
+// a row vector of the flat size is one message, other matrices hold one message per column
+TEST(Numeric, FlatColumns)
+{
+  DecoderConstPtr decoder = Decoder::forDefinition("test_msgs/Point", "float64 x\nfloat64 y\nfloat64 z\n");
+  decoder->verifyFlatLayout(3);
+  ASSERT_TRUE(decoder->isFlat());
+
+  mxArray *row = mxCreateDoubleMatrix(1, 3, mxREAL);
+  mxArray *columns = mxCreateDoubleMatrix(3, 5, mxREAL);
+  mxArray *other = mxCreateDoubleMatrix(1, 4, mxREAL);
+  EXPECT_EQ(1u, decoder->getFlatColumns(row));
+  EXPECT_EQ(5u, decoder->getFlatColumns(columns));
+  EXPECT_EQ(0u, decoder->getFlatColumns(other));
+  mxDestroyArray(row);
+  mxDestroyArray(columns);
+  mxDestroyArray(other);
+
+  // with a flat size of 1 every element of a row vector is a message
+  DecoderConstPtr scalar = Decoder::forDefinition("test_msgs/Scalar", "float64 data\n");
+  scalar->verifyFlatLayout(1);
+  mxArray *scalars = mxCreateDoubleMatrix(1, 4, mxREAL);
+  EXPECT_EQ(4u, scalar->getFlatColumns(scalars));
+  mxDestroyArray(scalars);
+}
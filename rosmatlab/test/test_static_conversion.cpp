@@ -0,0 +1,185 @@
+//=================================================================================================
+// Copyright (c) 2013, Johannes Meyer, TU Darmstadt
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of the Flight Systems and Automatic Control group,
+//       TU Darmstadt, nor the names of its contributors may be used to
+//       endorse or promote products derived from this software without
+//       specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//=================================================================================================
+
+#include <rosmatlab/static_conversion.h>
+#include <gtest/gtest.h>
+
+#include <cstring>
+#include <limits>
+
+using namespace rosmatlab;
+
+// a hand-written message with the serializer that the message generator would declare
+namespace test_msgs {
+  struct Image {
+    uint32_t height;
+    uint32_t width;
+    std::string encoding;
+    uint8_t is_bigendian;
+    uint32_t step;
+    std::vector<float> ranges;
+    std::vector<uint8_t> data;
+  };
+}
+
+namespace ros {
+namespace message_traits {
+  template <> struct IsMessage<test_msgs::Image> { static const bool value = true; };
+  template <> struct DataType<test_msgs::Image> { static const char *value() { return "sensor_msgs/Image"; } };
+  template <> struct MD5Sum<test_msgs::Image> { static const char *value() { return "*"; } };
+}
+namespace serialization {
+  template <> struct Serializer<test_msgs::Image> {
+    template <typename Stream, typename T> inline static void allInOne(Stream& stream, T m) {
+      stream.next(m.height);
+      stream.next(m.width);
+      stream.next(m.encoding);
+      stream.next(m.is_bigendian);
+      stream.next(m.step);
+      stream.next(m.ranges);
+      stream.next(m.data);
+    }
+  };
+}
+}
+
+namespace {
+  const char *IMAGE_DEFINITION =
+      "uint32 height\n"
+      "uint32 width\n"
+      "string encoding\n"
+      "uint8 is_bigendian\n"
+      "uint32 step\n"
+      "float32[] ranges\n"
+      "uint8[] data\n";
+
+  template <typename T> void append(std::vector<uint8_t>& data, const T& value) {
+    const uint8_t *bytes = reinterpret_cast<const uint8_t *>(&value);
+    data.insert(data.end(), bytes, bytes + sizeof(T));
+  }
+
+  template <typename T> void append(std::vector<uint8_t>& data, const std::vector<T>& values) {
+    append(data, static_cast<uint32_t>(values.size()));
+    for(std::size_t i = 0; i < values.size(); ++i) append(data, values[i]);
+  }
+
+  test_msgs::Image createImage(std::size_t height, std::size_t width) {
+    test_msgs::Image image;
+    image.height = height;
+    image.width = width;
+    image.encoding = "rgb8";
+    image.is_bigendian = 0;
+    image.step = 3 * width + 2;
+    image.ranges.resize(width);
+    for(std::size_t i = 0; i < image.ranges.size(); ++i) image.ranges[i] = 0.5f * i;
+    image.data.resize(height * image.step);
+    for(std::size_t i = 0; i < image.data.size(); ++i) image.data[i] = i * 7;
+    return image;
+  }
+
+  std::vector<uint8_t> serialize(const test_msgs::Image& image) {
+    std::vector<uint8_t> data;
+    append(data, image.height);
+    append(data, image.width);
+    append(data, static_cast<uint32_t>(image.encoding.size()));
+    data.insert(data.end(), image.encoding.begin(), image.encoding.end());
+    append(data, image.is_bigendian);
+    append(data, image.step);
+    append(data, image.ranges);
+    append(data, image.data);
+    return data;
+  }
+
+  void expectEqualArrays(const mxArray *expected, const mxArray *actual) {
+    ASSERT_TRUE(expected && actual);
+    EXPECT_EQ(mxGetClassID(expected), mxGetClassID(actual));
+    ASSERT_EQ(mxGetNumberOfDimensions(expected), mxGetNumberOfDimensions(actual));
+    for(std::size_t k = 0; k < mxGetNumberOfDimensions(expected); ++k) EXPECT_EQ(mxGetDimensions(expected)[k], mxGetDimensions(actual)[k]);
+    ASSERT_EQ(mxGetNumberOfElements(expected) * mxGetElementSize(expected), mxGetNumberOfElements(actual) * mxGetElementSize(actual));
+    EXPECT_EQ(0, std::memcmp(mxGetData(expected), mxGetData(actual), mxGetNumberOfElements(expected) * mxGetElementSize(expected)));
+  }
+
+  // the typed instance gives the same struct as decoding its serialized form
+  void compare(const test_msgs::Image& image, bool reshape, bool native) {
+    DecoderConstPtr decoder = Decoder::forDefinition("sensor_msgs/Image", IMAGE_DEFINITION);
+    ConversionOptions::Snapshot options = ConversionOptions().snapshot();
+    options.type = ConversionOptions::MATLAB_STRUCT;
+    options.reshape = reshape;
+    options.numeric = native ? ConversionOptions::NUMERIC_NATIVE : ConversionOptions::NUMERIC_DOUBLE;
+    options.add_meta_data = false;
+    Decoder::PlanConstPtr plan = decoder->compile(options);
+
+    std::vector<uint8_t> serialized = serialize(image);
+    ros::serialization::IStream stream(serialized.data(), serialized.size());
+    mxArray *decoded = decoder->decode(stream, *plan);
+
+    Decoder::Jobs jobs;
+    StaticConverterT<test_msgs::Image> converter;
+    mxArray *converted = converter.toMatlab(&image, *decoder, *plan, 0, 0, 0, &jobs);
+    jobs.finish();
+
+    const char *fields[] = { "height", "width", "is_bigendian", "step", "ranges", "data" };
+    for(std::size_t i = 0; i < sizeof(fields)/sizeof(*fields); ++i) {
+      SCOPED_TRACE(fields[i]);
+      expectEqualArrays(mxGetField(decoded, 0, fields[i]), mxGetField(converted, 0, fields[i]));
+    }
+    if (reshape) EXPECT_EQ(3u, mxGetNumberOfDimensions(mxGetField(converted, 0, "data")));
+
+    mxDestroyArray(decoded);
+    mxDestroyArray(converted);
+  }
+}
+
+TEST(StaticConversion, Arrays)         { compare(createImage(5, 7), false, true); }
+TEST(StaticConversion, ArraysAsDouble) { compare(createImage(5, 7), false, false); }
+TEST(StaticConversion, ReshapedImage)  { compare(createImage(5, 7), true, true); }
+TEST(StaticConversion, EmptyImage)     { compare(createImage(0, 0), true, true); }
+
+// payloads above the minimum length of the jobs are copied by them
+TEST(StaticConversion, LargeImage)     { compare(createImage(480, 640), true, false); }
+
+// typed instances are set with the same saturating conversions as serialized messages
+TEST(StaticConversion, FromArraySaturates)
+{
+  mxArray *source = mxCreateDoubleMatrix(1, 5, mxREAL);
+  double values[] = { 300.0, -5.0, 2.5, std::numeric_limits<double>::quiet_NaN(), 1.49 };
+  std::memcpy(mxGetPr(source), values, sizeof(values));
+
+  uint8_t bytes[5];
+  static_conversion::fromArray(source, bytes, 5);
+  EXPECT_EQ(255, bytes[0]);
+  EXPECT_EQ(0, bytes[1]);
+  EXPECT_EQ(3, bytes[2]);
+  EXPECT_EQ(0, bytes[3]);
+  EXPECT_EQ(1, bytes[4]);
+  mxDestroyArray(source);
+
+  mxArray *text = mxCreateString("abc");
+  EXPECT_THROW(static_conversion::fromArray(text, bytes, 3), Exception);
+  mxDestroyArray(text);
+}
@@ -0,0 +1,194 @@
+//=================================================================================================
+// Copyright (c) 2013, Johannes Meyer, TU Darmstadt
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of the Flight Systems and Automatic Control group,
+//       TU Darmstadt, nor the names of its contributors may be used to
+//       endorse or promote products derived from this software without
+//       specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//=================================================================================================
+
+#include <rosmatlab/transpose.h>
+#include <rosmatlab/conversion.h>
+#include <gtest/gtest.h>
+
+#include <cstdlib>
+#include <cstring>
+
+using namespace rosmatlab;
+
+namespace {
+  const char *MULTIARRAY_DEFINITION =
+      "MultiArrayLayout layout\n"
+      "float32[] data\n"
+      "================================================================================\n"
+      "MSG: std_msgs/MultiArrayLayout\n"
+      "MultiArrayDimension[] dim\n"
+      "uint32 data_offset\n"
+      "================================================================================\n"
+      "MSG: std_msgs/MultiArrayDimension\n"
+      "string label\n"
+      "uint32 size\n"
+      "uint32 stride\n";
+
+  // a row-major image with padding at the end of every row, transposed plane by plane
+  template <typename T> void roundTrip(std::size_t height, std::size_t width, std::size_t channels, Decoder::FieldType type) {
+    std::size_t step = width * channels * sizeof(T) + 3;
+    std::vector<uint8_t> source(height * step);
+    for(std::size_t i = 0; i < source.size(); ++i) source[i] = std::rand();
+
+    std::vector<T> planes(height * width * channels);
+    std::vector<double> doubles(planes.size());
+    for(std::size_t c = 0; c < channels; ++c) {
+      transpose(reinterpret_cast<uint8_t *>(&planes[c * height * width]), sizeof(T), height * sizeof(T),
+                &source[c * sizeof(T)], step, channels * sizeof(T), height, width, sizeof(T));
+      transposeToDouble(reinterpret_cast<uint8_t *>(&doubles[c * height * width]), sizeof(double), height * sizeof(double),
+                        &source[c * sizeof(T)], step, channels * sizeof(T), height, width, type);
+    }
+
+    for(std::size_t r = 0; r < height; ++r) {
+      for(std::size_t c = 0; c < width; ++c) {
+        for(std::size_t k = 0; k < channels; ++k) {
+          T value;
+          std::memcpy(&value, &source[r * step + (c * channels + k) * sizeof(T)], sizeof(T));
+          std::size_t i = r + height * (c + width * k);
+          ASSERT_EQ(value, planes[i]) << height << "x" << width << "x" << channels << " at " << r << "," << c << "," << k;
+          ASSERT_EQ(static_cast<double>(value), doubles[i]);
+        }
+      }
+    }
+
+    // the padding of the target rows is left untouched
+    std::vector<uint8_t> back(height * step, 0);
+    std::vector<uint8_t> back_from_double(height * step, 0);
+    for(std::size_t c = 0; c < channels; ++c) {
+      transpose(&back[c * sizeof(T)], step, channels * sizeof(T),
+                reinterpret_cast<const uint8_t *>(&planes[c * height * width]), sizeof(T), height * sizeof(T), height, width, sizeof(T));
+      transposeFromDouble(&back_from_double[c * sizeof(T)], step, channels * sizeof(T),
+                          reinterpret_cast<const uint8_t *>(&doubles[c * height * width]), sizeof(double), height * sizeof(double), height, width, type);
+    }
+    for(std::size_t r = 0; r < height; ++r) {
+      EXPECT_EQ(0, std::memcmp(&back[r * step], &source[r * step], width * channels * sizeof(T))) << "row " << r;
+      EXPECT_EQ(0, std::memcmp(&back_from_double[r * step], &source[r * step], width * channels * sizeof(T))) << "row " << r;
+      for(std::size_t i = width * channels * sizeof(T); i < step; ++i) EXPECT_EQ(0, back[r * step + i]);
+    }
+  }
+
+  const std::size_t SIZES[][3] = { {1, 1, 1}, {7, 9, 1}, {8, 8, 1}, {64, 33, 1}, {40, 40, 2}, {100, 71, 3}, {33, 65, 4} };
+
+  ConversionOptions::Snapshot reshapeOptions() {
+    ConversionOptions::Snapshot options = ConversionOptions().snapshot();
+    options.type = ConversionOptions::MATLAB_STRUCT;
+    options.numeric = ConversionOptions::NUMERIC_NATIVE;
+    options.reshape = true;
+    return options;
+  }
+
+  // a 2 x 3 x ... array with the given layout, the data is filled with 0, 1, 2, ...
+  std::vector<uint8_t> serializeMultiArray(const std::vector<uint32_t>& sizes, const std::vector<uint32_t>& strides, uint32_t data_offset, uint32_t count) {
+    std::vector<uint8_t> buffer;
+    std::vector<uint32_t> words;
+    words.push_back(sizes.size());
+    for(std::size_t j = 0; j < sizes.size(); ++j) {
+      words.push_back(0);  // empty label
+      words.push_back(sizes[j]);
+      words.push_back(strides[j]);
+    }
+    words.push_back(data_offset);
+    words.push_back(count);
+    buffer.resize(words.size() * sizeof(uint32_t) + count * sizeof(float));
+    std::memcpy(buffer.data(), words.data(), words.size() * sizeof(uint32_t));
+    for(uint32_t i = 0; i < count; ++i) {
+      float value = i;
+      std::memcpy(buffer.data() + (words.size() + i) * sizeof(uint32_t), &value, sizeof(float));
+    }
+    return buffer;
+  }
+
+  mxArray *decodeMultiArray(const std::vector<uint8_t>& buffer) {
+    DecoderConstPtr decoder = Decoder::forDefinition("std_msgs/Float32MultiArray", MULTIARRAY_DEFINITION);
+    ros::serialization::IStream stream(const_cast<uint8_t *>(buffer.data()), buffer.size());
+    return decoder->decode(stream, *decoder->compile(reshapeOptions()));
+  }
+}
+
+TEST(Transpose, RoundTrip)
+{
+  for(std::size_t i = 0; i < sizeof(SIZES)/sizeof(*SIZES); ++i) {
+    roundTrip<uint8_t>(SIZES[i][0], SIZES[i][1], SIZES[i][2], Decoder::UINT8);
+    roundTrip<uint16_t>(SIZES[i][0], SIZES[i][1], SIZES[i][2], Decoder::UINT16);
+    roundTrip<uint32_t>(SIZES[i][0], SIZES[i][1], SIZES[i][2], Decoder::UINT32);
+    roundTrip<int16_t>(SIZES[i][0], SIZES[i][1], SIZES[i][2], Decoder::INT16);
+  }
+}
+
+TEST(Transpose, MultiArrayIsReshaped)
+{
+  uint32_t sizes[] = { 2, 3 }, strides[] = { 6, 3 };
+  mxArray *message = decodeMultiArray(serializeMultiArray(std::vector<uint32_t>(sizes, sizes + 2), std::vector<uint32_t>(strides, strides + 2), 0, 6));
+  const mxArray *data = mxGetField(message, 0, "data");
+  ASSERT_TRUE(data);
+  ASSERT_EQ(2u, mxGetM(data));
+  ASSERT_EQ(3u, mxGetN(data));
+
+  // element (r,c) is r * 3 + c in row-major order
+  const float *x = static_cast<const float *>(mxGetData(data));
+  for(std::size_t r = 0; r < 2; ++r) {
+    for(std::size_t c = 0; c < 3; ++c) EXPECT_EQ(static_cast<float>(r * 3 + c), x[r + 2 * c]);
+  }
+  mxDestroyArray(message);
+}
+
+TEST(Transpose, MultiArrayOutOfBoundsIsNotReshaped)
+{
+  // singleton dimensions with empty data, a layout larger than data and a data offset behind the data
+  uint32_t sizes[][2] = { {1, 1}, {2, 3}, {2, 3} }, strides[][2] = { {1, 1}, {6, 3}, {6, 3} };
+  uint32_t offsets[] = { 0, 0, 1 }, counts[] = { 0, 5, 6 };
+  for(std::size_t i = 0; i < 3; ++i) {
+    mxArray *message = decodeMultiArray(serializeMultiArray(std::vector<uint32_t>(sizes[i], sizes[i] + 2), std::vector<uint32_t>(strides[i], strides[i] + 2), offsets[i], counts[i]));
+    const mxArray *data = mxGetField(message, 0, "data");
+    ASSERT_TRUE(data);
+    EXPECT_EQ(counts[i], mxGetNumberOfElements(data)) << "case " << i;
+    EXPECT_TRUE(counts[i] == 0 || mxGetM(data) == 1 || mxGetN(data) == 1) << "case " << i;
+    mxDestroyArray(message);
+  }
+}
+
+TEST(Transpose, MultiArrayEncodeChecksLayout)
+{
+  DecoderConstPtr decoder = Decoder::forDefinition("std_msgs/Float32MultiArray", MULTIARRAY_DEFINITION);
+  uint32_t sizes[] = { 2, 3 }, strides[] = { 6, 3 };
+  std::vector<uint8_t> serialized = serializeMultiArray(std::vector<uint32_t>(sizes, sizes + 2), std::vector<uint32_t>(strides, strides + 2), 0, 6);
+  mxArray *message = decodeMultiArray(serialized);
+
+  std::vector<uint8_t> buffer;
+  ASSERT_TRUE(decoder->encode(message, 0, buffer));
+  EXPECT_EQ(serialized, buffer);
+
+  // the array does not match the layout any more
+  mxArray *data = mxGetField(message, 0, "data");
+  mwSize transposed[] = { 3, 2 };
+  mxSetDimensions(data, transposed, 2);
+  buffer.clear();
+  EXPECT_FALSE(decoder->encode(message, 0, buffer));
+
+  mxDestroyArray(message);
+}
@@ -31,6 +31,8 @@
 
 #include <rosbag/view.h>
 #include <rosmatlab/object.h>
+#include <rosmatlab/decoder.h>
+#include <rosmatlab/conversion.h>
 
 #include <introspection/forwards.h>
 
@@ -90,13 +92,14 @@ public:
 private:
   iterator& operator*();
   MessageInstance* operator->();
-  mxArray *getInternal(mxArray *target, std::size_t index = 0, std::size_t size = 0);
+  mxArray *getInternal(mxArray *target, std::size_t index = 0, std::size_t size = 0, Decoder::Jobs *jobs = 0, ConversionPtr *conversion = 0);
 
 private:
   std::vector<boost::shared_ptr<Query> > queries_;
   std::vector<uint8_t> read_buffer_;
+  std::size_t read_size_;
 
-  cpp_introspection::MessagePtr message_instance_;
+  cpp_introspection::MessagePtr message_type_;
   iterator current_;
   bool eof_;
 };
@@ -39,6 +39,7 @@
 #include <introspection/message.h>
 
 #include <boost/algorithm/string/replace.hpp>
+#include <cstring>
 
 
 namespace rosmatlab {
@@ -90,6 +91,7 @@ void View::reset()
 {
   current_ = end();
   eof_ = false;
+  read_size_ = 0;
 }
 
 bool View::start()
@@ -100,7 +102,7 @@ bool View::start()
 }
 
 void View::increment() {
-  message_instance_.reset();
+  message_type_.reset();
   if (eof_) return;
 
   // reset current iterator
@@ -150,36 +152,66 @@ void View::next(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
   if (nlhs > 0) get(nlhs, plhs, nrhs, prhs);
 }
 
-mxArray *View::getInternal(mxArray *target, std::size_t index, std::size_t size)
+namespace {
+  // batches reuse one conversion per topic, so that its options and plans are only set up once
+  Conversion& reuse(ConversionPtr& conversion, const MessagePtr& message_type, Decoder::Jobs *jobs) {
+    if (!conversion || std::strcmp(conversion->getMessage()->getMD5Sum(), message_type->getMD5Sum()) != 0) {
+      conversion.reset(new Conversion(message_type));
+    }
+    return conversion->setJobs(jobs);
+  }
+}
+
+mxArray *View::getInternal(mxArray *target, std::size_t index, std::size_t size, Decoder::Jobs *jobs, ConversionPtr *conversion)
 {
+  ConversionPtr single;
+  ConversionPtr& cached = conversion ? *conversion : single;
+
    // go to the first entry if the current iterator is not valid
   if (!valid()) increment();
 
-  // introspect message
-  if (valid() && !message_instance_) {
-    MessagePtr introspection = messageByMD5Sum(current_->getMD5Sum());
-    if (introspection) {
-      // copy the serialized message to the read buffer (ugly)
-      std::size_t size = current_->size();
-      if (read_buffer_.size() < size) read_buffer_.resize(size);
-      ros::serialization::OStream ostream(read_buffer_.data(), read_buffer_.size());
+  // deferred jobs read from the serialized message after the conversion, so it is copied into
+  // uninitialized storage owned by them and from there once into the Matlab arrays
+  if (jobs && valid() && !message_type_) {
+    MessagePtr message_type = messageByMD5Sum(current_->getMD5Sum());
+    if (message_type) {
+      std::size_t length = current_->size();
+      uint8_t *data = jobs->allocate(length);
+      ros::serialization::OStream ostream(data, length);
       current_->write(ostream);
+      ros::serialization::IStream istream(data, length);
+      return reuse(cached, message_type, jobs).toMatlab(istream, target, index, size);
+    }
+  }
 
-      // deserialize message
-      ros::serialization::IStream istream(read_buffer_.data(), size);
-      VoidPtr msg = introspection->deserialize(istream);
-      if (!msg) ROSMATLAB_WARN("deserialization of a message of type %s failed", current_->getDataType().c_str());
-
-      message_instance_ = introspection->introspect(msg);
+  // copy the serialized message to the read buffer (ugly)
+  if (valid() && !message_type_) {
+    message_type_ = messageByMD5Sum(current_->getMD5Sum());
+    if (message_type_) {
+      read_size_ = current_->size();
+      if (read_buffer_.size() < read_size_) read_buffer_.resize(read_size_);
+      ros::serialization::OStream ostream(read_buffer_.data(), read_buffer_.size());
+      current_->write(ostream);
     } else {
       ROSMATLAB_PRINTF("Unknown data type '%s' in bag file", current_->getDataType().c_str());
       // throw UnknownDataTypeException(current_->getDataType());
     }
   }
 
-  // convert message instance to Matlab
-  if (message_instance_) {
-    target = Conversion(message_instance_).toMatlab(target, index, size);
+  // a message that has already been read is handed over to the jobs with the read buffer
+  if (message_type_ && jobs) {
+    std::vector<uint8_t>& buffer = jobs->hold(0);
+    buffer.swap(read_buffer_);
+    MessagePtr message_type = message_type_;
+    message_type_.reset();
+    ros::serialization::IStream istream(buffer.data(), read_size_);
+    return reuse(cached, message_type, jobs).toMatlab(istream, target, index, size);
+  }
+
+  // convert message to Matlab
+  if (message_type_) {
+    ros::serialization::IStream istream(read_buffer_.data(), read_size_);
+    target = reuse(cached, message_type_, 0).toMatlab(istream, target, index, size);
   } else {
     target = mxCreateStructMatrix(0, 0, 0, 0);
   }
@@ -188,12 +220,15 @@ mxArray *View::getInternal(mxArray *target, std::size_t index, std::size_t size)
 }
 
 namespace {
+  const std::size_t JOBS_LENGTH = 256 << 20;
+
   struct FieldInfo {
     std::string topic;
     std::string name;
     int fieldnum;
     std::size_t index;
     std::size_t size;
+    ConversionPtr conversion;
   };
 }
 
@@ -223,7 +258,8 @@ void View::data(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
   // create result struct
   mxArray *data = mxCreateStructMatrix(1, 1, fieldnames.size(), fieldnames.data());
 
-  // iterate through View
+  // iterate through View, large payloads are filled in parallel (at least every JOBS_LENGTH bytes)
+  Decoder::Jobs jobs;
   for(start(); valid(); increment()) {
     if (!topics.count(current_->getTopic())) continue;
     FieldInfo &field = topics[current_->getTopic()];
@@ -241,11 +277,13 @@ void View::data(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
 
     assert(field.index < field.size);
     // ROSMATLAB_PRINTF("Converting entry %u/%u of field %s", field.index, field.size, field.name.c_str());
-    target = getInternal(target, field.index++, field.size);
+    target = getInternal(target, field.index++, field.size, &jobs, &field.conversion);
 //    if (!target) target = mxCreateDoubleScalar(field.size); // debugging only
 
     mxSetFieldByNumber(data, 0, field.fieldnum, target);
+    if (jobs.length() >= JOBS_LENGTH) jobs.run();
   }
+  jobs.finish();
 
   // return result
   plhs[0] = data;